@@ -0,0 +1,101 @@
+// Compares the SA-IS suffix sorter behind bwtTransform with the old
+// rotation comparator on degenerate inputs.
+//
+//   g++ -std=c++17 -O2 -I../DiplomnaRabota BwtBenchmark.cpp ../DiplomnaRabota/SuffixArray.cpp -o BwtBenchmark
+//   ./BwtBenchmark [size] [log files...]
+#include "SuffixArray.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+static constexpr size_t LEGACY_LIMIT = 64 * 1024;
+
+static void legacySort(const std::string& s) {
+    int n = int(s.size());
+    std::vector<int> idx(n);
+    std::iota(idx.begin(), idx.end(), 0);
+    std::sort(idx.begin(), idx.end(), [&](int a, int b) {
+        for (int k = 0; k < n; ++k) {
+            char ca = s[(a + k) % n];
+            char cb = s[(b + k) % n];
+            if (ca != cb) return ca < cb;
+        }
+        return false;
+        });
+}
+
+static void saisSort(const std::string& s) {
+    std::vector<int32_t> sa(s.size() + 1);
+    buildSuffixArray(reinterpret_cast<const uint8_t*>(s.data()), sa.data(), int32_t(s.size()));
+}
+
+template <typename F>
+static double seconds(F&& f) {
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static std::string periodicLines(size_t n) {
+    std::string s;
+    while (s.size() < n) s += "GET /api/v1/health HTTP/1.1 200 OK\n";
+    s.resize(n);
+    return s;
+}
+
+static std::string syntheticLog(size_t n) {
+    static const char* levels[] = { "INFO", "INFO", "INFO", "WARN", "ERROR" };
+    std::string s;
+    uint32_t x = 12345;
+    for (unsigned i = 0; s.size() < n; ++i) {
+        x = x * 1103515245u + 12345u;
+        char line[128];
+        std::snprintf(line, sizeof(line), "2024-03-%02u 10:%02u:%02u %s worker-%u processed id=%u in %ums\n",
+            1 + i / 86400 % 28, i / 60 % 60, i % 60, levels[(x >> 16) % 5], (x >> 8) % 8, i, (x >> 12) % 500);
+        s += line;
+    }
+    s.resize(n);
+    return s;
+}
+
+static std::string randomBytes(size_t n) {
+    std::string s(n, '\0');
+    uint32_t x = 2463534242u;
+    for (auto& c : s) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        c = char(x);
+    }
+    return s;
+}
+
+static void run(const char* name, const std::string& s) {
+    double fast = seconds([&] { saisSort(s); });
+    if (s.size() <= LEGACY_LIMIT) {
+        double slow = seconds([&] { legacySort(s); });
+        std::printf("%-16s %10zu  sa-is %9.4fs  comparator %9.4fs  x%.0f\n",
+            name, s.size(), fast, slow, slow / std::max(fast, 1e-9));
+    }
+    else {
+        std::printf("%-16s %10zu  sa-is %9.4fs  comparator    skipped\n", name, s.size(), fast);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16 * 1024;
+    run("all-a", std::string(n, 'a'));
+    run("periodic-lines", periodicLines(n));
+    run("synthetic-log", syntheticLog(n));
+    run("random", randomBytes(n));
+    for (int i = 2; i < argc; ++i) {
+        std::ifstream f(argv[i], std::ios::binary);
+        std::string s((std::istreambuf_iterator<char>(f)), {});
+        run(argv[i], s);
+    }
+    return 0;
+}
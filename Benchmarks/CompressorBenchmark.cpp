@@ -0,0 +1,549 @@
+// Times every stage of the pipeline on a fixed synthetic corpus and prints
+// the results as JSON, so runs on different machines or commits can be
+// diffed directly. The corpora are generated from fixed seeds; files given
+// on the command line are added as extra corpora.
+//
+//   CompressorBenchmark [--size BYTES] [--level N] [--block-size BYTES]
+//                       [--threads N] [--memory BYTES] [--no-mtf]
+//                       [--no-preprocess] [--repeat N] [--only NAME]
+//                       [--no-tools] [files...]
+//
+// Each stage is run --repeat times (default 3) and the fastest run is kept.
+// When gzip, xz or zstd are on PATH they are timed on the same corpus.
+// With --threads other than 1 the round trip is also timed on one thread
+// with seekable set, which writes the same archive. The run fails when the
+// archives differ or either direction gains less than 0.7 times the
+// workers that can run at once: the threads, cores and blocks, whichever
+// is fewest. With only one, the speedup check is reported as skipped.
+#include "Compressor.h"
+#include "Levels.h"
+#include "Models.h"
+#include "Preprocess.h"
+#include "RangeCoder.h"
+#include "Transforms.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Options {
+    size_t size = 1 << 20;
+    CompressorOptions codec;
+    int repeat = 3;
+    std::string only;
+    bool tools = true;
+    std::vector<std::string> files;
+};
+
+struct Corpus {
+    std::string name;
+    std::string data;
+};
+
+// xorshift32, so the corpora are identical on every platform.
+struct Random {
+    uint32_t x;
+    explicit Random(uint32_t seed) : x(seed) {}
+    uint32_t next() { x ^= x << 13; x ^= x >> 17; x ^= x << 5; return x; }
+    uint32_t below(uint32_t n) { return next() % n; }
+};
+
+std::string text(size_t n) {
+    static const char* words[] = {
+        "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "was", "with",
+        "be", "by", "on", "not", "he", "this", "are", "or", "his", "from", "at", "which",
+        "compression", "block", "transform", "sorting", "context", "model", "archive",
+        "probability", "entropy", "symbol", "stream", "window", "history", "table" };
+    const uint32_t count = sizeof(words) / sizeof(words[0]);
+    Random r(1);
+    std::string s;
+    bool capital = true;
+    while (s.size() < n) {
+        // Skewed towards the first words, roughly like natural text.
+        std::string w = words[std::min(r.below(count), r.below(count))];
+        if (capital) w[0] = char(w[0] - 'a' + 'A');
+        s += w;
+        capital = false;
+        uint32_t p = r.below(100);
+        if (p < 6) { s += ".\n"; capital = true; }
+        else if (p < 12) s += ", ";
+        else s += ' ';
+    }
+    s.resize(n);
+    return s;
+}
+
+std::string csv(size_t n) {
+    static const char* cities[] = { "Sofia", "Plovdiv", "Varna", "Burgas", "Ruse", "Stara Zagora" };
+    Random r(2);
+    std::string s = "id,date,city,quantity,price,total\n";
+    char line[128];
+    for (unsigned id = 1; s.size() < n; ++id) {
+        unsigned qty = 1 + r.below(20), cents = 99 + r.below(9900);
+        std::snprintf(line, sizeof(line), "%u,2024-%02u-%02u,%s,%u,%u.%02u,%u.%02u\n",
+            id, 1 + id / 3000 % 12, 1 + id / 100 % 28, cities[r.below(6)], qty,
+            cents / 100, cents % 100, qty * cents / 100, qty * cents % 100);
+        s += line;
+    }
+    s.resize(n);
+    return s;
+}
+
+std::string numeric(size_t n) {
+    Random r(3);
+    std::string s;
+    char line[64];
+    long long v = 100000;
+    while (s.size() < n) {
+        v += static_cast<long long>(r.below(2001)) - 1000;
+        std::snprintf(line, sizeof(line), "%lld %.3f\n", v, double(r.next()) / 4294967296.0);
+        s += line;
+    }
+    s.resize(n);
+    return s;
+}
+
+std::string logLines(size_t n) {
+    static const char* levels[] = { "INFO", "INFO", "INFO", "WARN", "ERROR" };
+    static const char* paths[] = { "/api/v1/users", "/api/v1/orders", "/health", "/static/app.js" };
+    Random r(4);
+    std::string s;
+    char line[160];
+    for (unsigned i = 0; s.size() < n; ++i) {
+        std::snprintf(line, sizeof(line),
+            "2024-03-%02u 10:%02u:%02u.%03u %-5s worker-%u GET %s status=%u in %ums\n",
+            1 + i / 86400 % 28, i / 60 % 60, i % 60, r.below(1000), levels[r.below(5)],
+            r.below(8), paths[r.below(4)], r.below(10) ? 200u : 500u, r.below(500));
+        s += line;
+    }
+    s.resize(n);
+    return s;
+}
+
+using Clock = std::chrono::steady_clock;
+
+template <typename F>
+double best(int repeat, F&& f) {
+    double fastest = 1e30;
+    for (int i = 0; i < repeat; ++i) {
+        auto t0 = Clock::now();
+        f();
+        fastest = std::min(fastest, std::chrono::duration<double>(Clock::now() - t0).count());
+    }
+    return fastest;
+}
+
+double mbps(size_t bytes, double seconds) {
+    return seconds > 0 ? double(bytes) / seconds / 1e6 : 0.0;
+}
+
+size_t peakRssKiB() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+    return size_t(pmc.PeakWorkingSetSize / 1024);
+#else
+    rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    return size_t(ru.ru_maxrss / 1024);
+#else
+    return size_t(ru.ru_maxrss);
+#endif
+#endif
+}
+
+// Splits the corpus into blocks the way the compressor does.
+std::vector<std::pair<const uint8_t*, size_t>> blocks(const std::string& data, size_t blockSize) {
+    std::vector<std::pair<const uint8_t*, size_t>> out;
+    auto p = reinterpret_cast<const uint8_t*>(data.data());
+    for (size_t off = 0; off < data.size(); off += blockSize)
+        out.push_back({ p + off, std::min(blockSize, data.size() - off) });
+    return out;
+}
+
+// Intermediate results of each stage for one block, kept so the next stage
+// can be timed on its own.
+struct BlockStages {
+    BlockFilter filter = BlockFilter::None;
+    std::string filtered;
+    std::string bwt;
+    std::vector<uint64_t> primaries;
+    std::vector<uint8_t> symbols;
+    std::vector<uint16_t> probs;
+    std::vector<uint8_t> coded;
+};
+
+struct Row {
+    std::vector<std::pair<std::string, double>> fields;
+    void add(const std::string& key, double v) { fields.push_back({ key, v }); }
+};
+
+// Counts print as integers, rates and ratios with four decimals.
+void printRow(const Row& row, const char* indent) {
+    for (size_t i = 0; i < row.fields.size(); ++i) {
+        double v = row.fields[i].second;
+        std::printf("%s\"%s\": %.*f%s\n", indent, row.fields[i].first.c_str(),
+            v == double(int64_t(v)) ? 0 : 4, v, i + 1 < row.fields.size() ? "," : "");
+    }
+}
+
+// Times each pipeline stage separately; the model is timed without coding
+// and the coder replays the recorded probabilities without the model.
+Row stages(const Corpus& c, const Options& opt) {
+    auto parts = blocks(c.data, opt.codec.blockSize);
+    std::vector<BlockStages> st(parts.size());
+    size_t n = c.data.size();
+    const LevelParams& lp = levelParams(opt.codec.level);
+    bool mtf = lp.mtf && opt.codec.mtf;
+    size_t tableBytes = opt.codec.modelMemory ? opt.codec.modelMemory : size_t(1) << lp.tableBits;
+    Row row;
+
+    if (opt.codec.preprocess) {
+        row.add("filter_mbps", mbps(n, best(opt.repeat, [&] {
+            for (size_t i = 0; i < parts.size(); ++i)
+                st[i].filtered = filterBlock(parts[i].first, parts[i].second, !mtf, st[i].filter);
+        })));
+    }
+    else {
+        for (size_t i = 0; i < parts.size(); ++i)
+            st[i].filtered.assign(parts[i].first, parts[i].first + parts[i].second);
+    }
+    row.add("bwt_mbps", mbps(n, best(opt.repeat, [&] {
+        for (auto& b : st)
+            std::tie(b.bwt, b.primaries) = bwtTransform(reinterpret_cast<const uint8_t*>(b.filtered.data()),
+                b.filtered.size(), bwtStreamsFor(b.filtered.size()));
+    })));
+    if (mtf) {
+        row.add("mtf_rle_mbps", mbps(n, best(opt.repeat, [&] {
+            for (auto& b : st) b.symbols = rleZero(mtfEncode(b.bwt));
+        })));
+    }
+    else {
+        for (auto& b : st) b.symbols.assign(b.bwt.begin(), b.bwt.end());
+    }
+    size_t symbols = 0;
+    for (auto& b : st) symbols += b.symbols.size();
+
+    auto model = [&](auto& ms) {
+        for (auto& b : st) {
+            b.probs.clear();
+            b.probs.reserve(b.symbols.size() * 8);
+            for (uint8_t byte : b.symbols) {
+                for (int k = 7; k >= 0; --k) {
+                    b.probs.push_back(ms.predict());
+                    ms.update((byte >> k) & 1);
+                }
+            }
+        }
+    };
+    // The run-time ModelSet goes first so the probabilities the coder
+    // replays below come from the pipeline the compressor uses.
+    row.add("model_dynamic_mbps", mbps(n, best(opt.repeat, [&] {
+        ModelSet ms(tableBytes, lp.models);
+        model(ms);
+    })));
+    row.add("model_mbps", mbps(n, best(opt.repeat, [&] {
+        withModelPipeline(opt.codec.level, [&](auto tag) {
+            typename decltype(tag)::type ms(tableBytes);
+            model(ms);
+        });
+    })));
+    row.add("encode_mbps", mbps(n, best(opt.repeat, [&] {
+        for (auto& b : st) {
+            b.coded.clear();
+            RangeCoder coder(b.coded);
+            size_t k = 0;
+            for (uint8_t byte : b.symbols)
+                for (int bit = 7; bit >= 0; --bit)
+                    coder.encode((byte >> bit) & 1, b.probs[k++]);
+            coder.finish();
+        }
+    })));
+    bool ok = true;
+    row.add("decode_mbps", mbps(n, best(opt.repeat, [&] {
+        for (auto& b : st) {
+            RangeDecoder dec(b.coded.data(), b.coded.size());
+            size_t k = 0;
+            for (uint8_t byte : b.symbols) {
+                uint32_t v = 1;
+                while (v < 256) v = (v << 1) | uint32_t(dec.decode(b.probs[k++]));
+                ok &= uint8_t(v) == byte;
+            }
+        }
+    })));
+    if (mtf) {
+        row.add("unmtf_unrle_mbps", mbps(n, best(opt.repeat, [&] {
+            for (auto& b : st) ok &= mtfDecode(rleZeroDecode(b.symbols)) == b.bwt;
+        })));
+    }
+    row.add("unbwt_mbps", mbps(n, best(opt.repeat, [&] {
+        for (auto& b : st) ok &= bwtInverse(b.bwt, b.primaries) == b.filtered;
+    })));
+    if (opt.codec.preprocess) {
+        row.add("unfilter_mbps", mbps(n, best(opt.repeat, [&] {
+            for (size_t i = 0; i < parts.size(); ++i) {
+                std::string back = unfilterBlock(st[i].filter, st[i].filtered);
+                ok &= back.size() == parts[i].second
+                    && std::equal(back.begin(), back.end(), parts[i].first);
+            }
+        })));
+    }
+    size_t coded = 0;
+    for (auto& b : st) coded += b.coded.size();
+    size_t filtered = 0;
+    for (auto& b : st) filtered += b.filtered.size();
+    row.add("filtered_bytes", double(filtered));
+    row.add("symbols", double(symbols));
+    row.add("coded_bytes", double(coded));
+    row.add("stages_ok", ok ? 1 : 0);
+    return row;
+}
+
+Row endToEnd(const Corpus& c, const Options& opt) {
+    std::string packed, unpacked;
+    Row row;
+    row.add("compress_mbps", mbps(c.data.size(), best(opt.repeat, [&] {
+        std::istringstream in(c.data);
+        std::ostringstream out;
+        Compressor::compress(in, out, opt.codec);
+        packed = out.str();
+    })));
+    row.add("decompress_mbps", mbps(c.data.size(), best(opt.repeat, [&] {
+        std::istringstream in(packed);
+        std::ostringstream out;
+        Compressor::decompress(in, out, opt.codec);
+        unpacked = out.str();
+    })));
+    row.add("compressed_bytes", double(packed.size()));
+    row.add("ratio", c.data.empty() ? 0.0 : double(packed.size()) / double(c.data.size()));
+    row.add("bits_per_byte", c.data.empty() ? 0.0 : 8.0 * double(packed.size()) / double(c.data.size()));
+    row.add("roundtrip_ok", unpacked == c.data ? 1 : 0);
+    return row;
+}
+
+// Throughput of the threaded round trip against one thread coding the
+// same independent blocks, which must produce identical archives.
+Row parallel(const Corpus& c, const Options& opt) {
+    CompressorOptions one = opt.codec;
+    one.threads = 1;
+    one.seekable = true;
+    std::string packed[2];
+    auto timeCompress = [&](const CompressorOptions& o, std::string& out) {
+        return best(opt.repeat, [&] {
+            std::istringstream in(c.data);
+            std::ostringstream os;
+            Compressor::compress(in, os, o);
+            out = os.str();
+        });
+    };
+    auto timeDecompress = [&](const CompressorOptions& o, const std::string& archive) {
+        return best(opt.repeat, [&] {
+            std::istringstream in(archive);
+            std::ostringstream os;
+            Compressor::decompress(in, os, o);
+        });
+    };
+    double ct = timeCompress(opt.codec, packed[0]);
+    double ct1 = timeCompress(one, packed[1]);
+    double dt = timeDecompress(opt.codec, packed[0]);
+    double dt1 = timeDecompress(one, packed[0]);
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    size_t parallel = std::min<size_t>({ opt.codec.threads ? opt.codec.threads : cores, cores,
+        (c.data.size() + opt.codec.blockSize - 1) / opt.codec.blockSize });
+    double cs = ct > 0 ? ct1 / ct : 0.0, ds = dt > 0 ? dt1 / dt : 0.0;
+    double expected = 0.7 * double(parallel);
+    Row row;
+    row.add("compress_mbps", mbps(c.data.size(), ct));
+    row.add("compress_one_thread_mbps", mbps(c.data.size(), ct1));
+    row.add("compress_speedup", cs);
+    row.add("decompress_mbps", mbps(c.data.size(), dt));
+    row.add("decompress_one_thread_mbps", mbps(c.data.size(), dt1));
+    row.add("decompress_speedup", ds);
+    row.add("identical", packed[0] == packed[1] ? 1 : 0);
+    if (parallel < 2) {
+        row.add("speedup_skipped", 1);
+    }
+    else {
+        row.add("expected_speedup", expected);
+        row.add("speedup_ok", cs >= expected && ds >= expected ? 1 : 0);
+    }
+    return row;
+}
+
+struct Tool {
+    const char* name;
+    const char* compress;
+    const char* decompress;
+};
+
+const Tool TOOLS[] = {
+    { "gzip-9", "gzip -9 -c", "gzip -d -c" },
+    { "xz-6", "xz -6 -c", "xz -d -c" },
+    { "zstd-19", "zstd -19 -q -c", "zstd -d -q -c" },
+};
+
+#ifdef _WIN32
+const char* const NULL_DEVICE = "NUL";
+#else
+const char* const NULL_DEVICE = "/dev/null";
+#endif
+
+bool onPath(const Tool& t) {
+    std::string probe = t.compress;
+    probe = probe.substr(0, probe.find(' ')) + " --version >" + NULL_DEVICE + " 2>&1";
+    return std::system(probe.c_str()) == 0;
+}
+
+// External tools are timed through the shell, so small corpora mostly
+// measure process start-up; their ratios are the useful part.
+bool runTool(const Tool& t, const Corpus& c, const Options& opt, Row& row) {
+    fs::path dir = fs::temp_directory_path();
+    fs::path plain = dir / ("zb-bench-" + c.name);
+    fs::path packed = plain.string() + ".z";
+    fs::path back = plain.string() + ".back";
+    std::ofstream(plain, std::ios::binary).write(c.data.data(), std::streamsize(c.data.size()));
+    std::string comp = std::string(t.compress) + " \"" + plain.string() + "\" > \"" + packed.string() + "\"";
+    std::string decomp = std::string(t.decompress) + " \"" + packed.string() + "\" > \"" + back.string() + "\"";
+    int status = 0;
+    double ct = best(opt.repeat, [&] { status |= std::system(comp.c_str()); });
+    double dt = best(opt.repeat, [&] { status |= std::system(decomp.c_str()); });
+    bool ok = status == 0 && fs::file_size(back) == c.data.size();
+    if (ok) {
+        row.add("compress_mbps", mbps(c.data.size(), ct));
+        row.add("decompress_mbps", mbps(c.data.size(), dt));
+        row.add("compressed_bytes", double(fs::file_size(packed)));
+        row.add("ratio", c.data.empty() ? 0.0 : double(fs::file_size(packed)) / double(c.data.size()));
+    }
+    std::error_code ec;
+    fs::remove(plain, ec);
+    fs::remove(packed, ec);
+    fs::remove(back, ec);
+    return ok;
+}
+
+Options parseArgs(int argc, char* argv[]) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::invalid_argument(arg + " needs a value");
+            return argv[++i];
+        };
+        if (arg == "--size") opt.size = std::stoull(value());
+        else if (arg == "--level") opt.codec.level = std::stoi(value());
+        else if (arg == "--block-size") opt.codec.blockSize = std::stoull(value());
+        else if (arg == "--threads") opt.codec.threads = unsigned(std::stoul(value()));
+        else if (arg == "--memory") opt.codec.modelMemory = std::stoull(value());
+        else if (arg == "--no-mtf") opt.codec.mtf = false;
+        else if (arg == "--no-preprocess") opt.codec.preprocess = false;
+        else if (arg == "--repeat") opt.repeat = std::max(1, std::stoi(value()));
+        else if (arg == "--only") opt.only = value();
+        else if (arg == "--no-tools") opt.tools = false;
+        else if (arg.size() > 1 && arg[0] == '-') throw std::invalid_argument("unknown option " + arg);
+        else opt.files.push_back(arg);
+    }
+    return opt;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    try {
+        opt = parseArgs(argc, argv);
+        levelParams(opt.codec.level);
+    }
+    catch (const std::exception& e) {
+        std::fprintf(stderr, "CompressorBenchmark: %s\n", e.what());
+        return 2;
+    }
+
+    std::vector<Corpus> corpora = {
+        { "text", text(opt.size) },
+        { "csv", csv(opt.size) },
+        { "numeric", numeric(opt.size) },
+        { "log", logLines(opt.size) },
+    };
+    for (const auto& name : opt.files) {
+        std::ifstream f(name, std::ios::binary);
+        if (!f) {
+            std::fprintf(stderr, "CompressorBenchmark: cannot open %s\n", name.c_str());
+            return 2;
+        }
+        corpora.push_back({ fs::path(name).filename().string(),
+            std::string((std::istreambuf_iterator<char>(f)), {}) });
+    }
+    if (!opt.only.empty()) {
+        corpora.erase(std::remove_if(corpora.begin(), corpora.end(),
+            [&](const Corpus& c) { return c.name != opt.only; }), corpora.end());
+        if (corpora.empty()) {
+            std::fprintf(stderr, "CompressorBenchmark: no corpus named %s\n", opt.only.c_str());
+            return 2;
+        }
+    }
+
+    std::vector<const Tool*> tools;
+    if (opt.tools)
+        for (const Tool& t : TOOLS)
+            if (onPath(t)) tools.push_back(&t);
+
+    bool allOk = true;
+    std::printf("{\n  \"config\": {\n");
+    std::printf("    \"level\": %d,\n", opt.codec.level);
+    std::printf("    \"block_size\": %zu,\n    \"threads\": %u,\n    \"model_memory\": %zu,\n",
+        opt.codec.blockSize, opt.codec.threads, opt.codec.modelMemory);
+    std::printf("    \"mtf\": %s,\n    \"preprocess\": %s,\n    \"repeat\": %d\n  },\n  \"corpora\": [\n",
+        opt.codec.mtf ? "true" : "false", opt.codec.preprocess ? "true" : "false", opt.repeat);
+    for (size_t i = 0; i < corpora.size(); ++i) {
+        const Corpus& c = corpora[i];
+        Row st = stages(c, opt);
+        Row e2e = endToEnd(c, opt);
+        allOk &= st.fields.back().second == 1 && e2e.fields.back().second == 1;
+        std::printf("    {\n      \"name\": \"%s\",\n      \"bytes\": %zu,\n", c.name.c_str(), c.data.size());
+        std::printf("      \"stages\": {\n");
+        printRow(st, "        ");
+        std::printf("      },\n      \"zerobit\": {\n");
+        printRow(e2e, "        ");
+        if (opt.codec.threads != 1) {
+            Row par = parallel(c, opt);
+            for (const auto& [key, v] : par.fields)
+                if (key == "identical" || key == "speedup_ok") allOk &= v == 1;
+            std::printf("      },\n      \"parallel\": {\n");
+            printRow(par, "        ");
+        }
+        std::printf("      },\n      \"tools\": {");
+        bool first = true;
+        for (const Tool* t : tools) {
+            Row row;
+            if (!runTool(*t, c, opt, row)) continue;
+            std::printf("%s\n        \"%s\": {\n", first ? "" : ",", t->name);
+            printRow(row, "          ");
+            std::printf("        }");
+            first = false;
+        }
+        std::printf("%s}\n    }%s\n", first ? "" : "\n      ", i + 1 < corpora.size() ? "," : "");
+    }
+    std::printf("  ],\n  \"peak_rss_kib\": %zu\n}\n", peakRssKiB());
+    return allOk ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+#include "Archive.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Leading bytes compared when ordering files of one extension: files that
+// start alike (same schema, same generator) usually continue alike.
+constexpr size_t HEAD_BYTES = 64;
+
+std::string lowerExtension(const std::string& name) {
+    std::string ext = fs::path(name).extension().string();
+    for (char& c : ext) c = char(std::tolower(uint8_t(c)));
+    return ext;
+}
+
+std::string readHead(const std::string& path) {
+    std::string head(HEAD_BYTES, '\0');
+    std::ifstream in(path, std::ios::binary);
+    in.read(&head[0], std::streamsize(head.size()));
+    head.resize(size_t(in.gcount()));
+    return head;
+}
+
+// Names are extracted below a root directory, so they must stay relative
+// and must not climb out of it.
+bool safeName(const std::string& name) {
+    if (name.empty() || name.front() == '/' || name.back() == '/') return false;
+    size_t start = 0;
+    for (;;) {
+        size_t end = name.find('/', start);
+        std::string part = name.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        if (part.empty() || part == "." || part == ".." || part.find_first_of("\\:") != std::string::npos
+            || part.find('\0') != std::string::npos)
+            return false;
+        if (end == std::string::npos) return true;
+        start = end + 1;
+    }
+}
+
+template <typename T>
+void put(std::string& out, T v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+[[noreturn]] void corrupt() {
+    throw std::runtime_error("Corrupt directory");
+}
+
+}
+
+PackList collectFiles(const std::vector<std::string>& inputs) {
+    struct Item { std::string ext, head, name, path; uint64_t size; };
+    std::vector<Item> items;
+    auto add = [&](const fs::path& file, std::string name) {
+        items.push_back({ lowerExtension(name), readHead(file.string()), std::move(name), file.string(),
+            uint64_t(fs::file_size(file)) });
+    };
+    for (const auto& input : inputs) {
+        fs::path p = fs::path(input).lexically_normal();
+        if (!p.has_filename()) p = p.parent_path();
+        if (fs::is_directory(p)) {
+            fs::path base = p.parent_path();
+            for (const auto& entry : fs::recursive_directory_iterator(p))
+                if (entry.is_regular_file())
+                    add(entry.path(), entry.path().lexically_relative(base).generic_string());
+        }
+        else if (fs::is_regular_file(p)) {
+            add(p, p.filename().generic_string());
+        }
+        else {
+            throw std::runtime_error("Input missing: " + input);
+        }
+    }
+
+    std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
+        if (a.ext != b.ext) return a.ext < b.ext;
+        if (a.head != b.head) return a.head < b.head;
+        return a.name < b.name;
+    });
+
+    PackList list;
+    std::unordered_set<std::string> names;
+    for (auto& item : items) {
+        if (!safeName(item.name))
+            throw std::runtime_error("Unsupported file name: " + item.name);
+        if (!names.insert(item.name).second)
+            throw std::runtime_error("Duplicate file name: " + item.name);
+        ArchiveEntry e;
+        e.name = std::move(item.name);
+        e.offset = list.totalSize;
+        e.size = item.size;
+        list.totalSize += item.size;
+        list.entries.push_back(std::move(e));
+        list.paths.push_back(std::move(item.path));
+    }
+    return list;
+}
+
+std::string encodeDirectory(const std::vector<ArchiveEntry>& entries) {
+    std::string out;
+    put(out, uint64_t(entries.size()));
+    for (const auto& e : entries) {
+        put(out, uint32_t(e.name.size()));
+        out += e.name;
+        put(out, e.size);
+        put(out, e.crc);
+    }
+    return out;
+}
+
+std::vector<ArchiveEntry> decodeDirectory(const uint8_t* data, size_t size, uint64_t streamSize) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    auto take = [&](void* v, size_t n) {
+        if (size_t(end - p) < n) corrupt();
+        std::memcpy(v, p, n);
+        p += n;
+    };
+    uint64_t count;
+    take(&count, sizeof(count));
+    if (count > size) corrupt();
+    std::vector<ArchiveEntry> entries(static_cast<size_t>(count));
+    std::unordered_set<std::string> names;
+    uint64_t offset = 0;
+    for (auto& e : entries) {
+        uint32_t nameLen;
+        take(&nameLen, sizeof(nameLen));
+        if (nameLen > size_t(end - p)) corrupt();
+        e.name.assign(reinterpret_cast<const char*>(p), nameLen);
+        p += nameLen;
+        take(&e.size, sizeof(e.size));
+        take(&e.crc, sizeof(e.crc));
+        if (!safeName(e.name) || !names.insert(e.name).second || e.size > streamSize - offset) corrupt();
+        e.offset = offset;
+        offset += e.size;
+    }
+    if (p != end || offset != streamSize) corrupt();
+    return entries;
+}
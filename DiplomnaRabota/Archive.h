@@ -0,0 +1,30 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "Compressor.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Files to pack, in the order they go into the stream; entries and paths
+// are parallel. Entry crcs are filled in while the files are read.
+struct PackList {
+    std::vector<ArchiveEntry> entries;
+    std::vector<std::string> paths;
+    uint64_t totalSize = 0;
+};
+
+// Expands the inputs (see Compressor::packFiles) and orders the files by
+// extension, then by their first bytes, then by name. Throws when two
+// files would get the same name.
+PackList collectFiles(const std::vector<std::string>& inputs);
+
+// The directory lists name, size and crc per file; offsets follow from the
+// sizes. decodeDirectory checks that the sizes add up to streamSize and
+// that every name is unique and stays below the extraction root.
+std::string encodeDirectory(const std::vector<ArchiveEntry>& entries);
+std::vector<ArchiveEntry> decodeDirectory(const uint8_t* data, size_t size, uint64_t streamSize);
+
+#endif
@@ -0,0 +1,89 @@
+#include "Checksum.h"
+
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define CHECKSUM_X64 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <nmmintrin.h>
+#else
+#include <cpuid.h>
+#include <nmmintrin.h>
+#endif
+#endif
+
+namespace {
+
+constexpr uint32_t POLY = 0x82F63B78;  // reflected Castagnoli polynomial
+
+struct Tables {
+    uint32_t t[8][256];
+    Tables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (POLY & (0u - (c & 1)));
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i)
+            for (int s = 1; s < 8; ++s)
+                t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+    }
+};
+
+const Tables tables;
+
+uint32_t crcSoftware(const uint8_t* p, size_t n, uint32_t c) {
+    const auto& t = tables.t;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint32_t lo, hi;
+        std::memcpy(&lo, p, 4);
+        std::memcpy(&hi, p + 4, 4);
+        lo ^= c;
+        c = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+            ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    }
+    for (; n; --n) c = (c >> 8) ^ t[0][(c ^ *p++) & 0xFF];
+    return c;
+}
+
+#ifdef CHECKSUM_X64
+#if !defined(_MSC_VER)
+__attribute__((target("sse4.2")))
+#endif
+uint32_t crcHardware(const uint8_t* p, size_t n, uint32_t c) {
+    uint64_t c64 = c;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        c64 = _mm_crc32_u64(c64, v);
+    }
+    c = uint32_t(c64);
+    for (; n; --n) c = _mm_crc32_u8(c, *p++);
+    return c;
+}
+
+bool hasSse42() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] >> 20) & 1;
+#else
+    unsigned a, b, c, d;
+    return __get_cpuid(1, &a, &b, &c, &d) && ((c >> 20) & 1);
+#endif
+}
+
+const bool useHardware = hasSse42();
+#endif
+
+}
+
+uint32_t crc32c(const void* data, size_t n, uint32_t crc) {
+    auto p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+#ifdef CHECKSUM_X64
+    if (useHardware) return ~crcHardware(p, n, crc);
+#endif
+    return ~crcSoftware(p, n, crc);
+}
@@ -0,0 +1,12 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has
+// it and a slicing-by-8 table otherwise; both give the same value. Pass the
+// previous result as crc to continue a checksum over several buffers.
+uint32_t crc32c(const void* data, size_t n, uint32_t crc = 0);
+
+#endif
@@ -1,510 +1,1565 @@
 ﻿#include "Compressor.h"
-#include <fstream>
-#include <sstream>
+#include "Archive.h"
+#include "Checksum.h"
+#include "Dictionary.h"
+#include "ThreadPool.h"
+#include "FileIO.h"
+#include "Levels.h"
+#include "Lz.h"
+#include "Models.h"
+#include "Preprocess.h"
+#include "RangeCoder.h"
+#include "Stats.h"
+#include "Transforms.h"
 #include <vector>
 #include <string>
+#include <string_view>
 #include <cstdint>
 #include <deque>
-#include <unordered_map>
-#include <numeric>
 #include <algorithm>
 #include <filesystem>
 #include <stdexcept>
+#include <memory>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <cstring>
+#include <cmath>
 
 namespace fs = std::filesystem;
 
-static constexpr size_t BLOCK_SIZE = 100 * 1024;
-
-static std::pair<std::string, uint32_t> bwtTransform(const std::string& s) {
-    int n = int(s.size());
-    std::vector<int> idx(n);
-    std::iota(idx.begin(), idx.end(), 0);
-    std::sort(idx.begin(), idx.end(), [&](int a, int b) {
-        for (int k = 0; k < n; ++k) {
-            char ca = s[(a + k) % n];
-            char cb = s[(b + k) % n];
-            if (ca != cb) return ca < cb;
-        }
-        return false;
-        });
-    std::string last(n, '\0');
-    uint32_t primary = 0;
-    for (int i = 0; i < n; ++i) {
-        int j = idx[i];
-        last[i] = s[(j + n - 1) % n];
-        if (j == 0) primary = i;
+static bool exists(const std::string& p) { return fs::exists(p); }
+
+static constexpr char MAGIC[2] = { 'Z', 'B' };
+static constexpr uint8_t FORMAT_VERSION = 12;
+static constexpr uint8_t FLAG_INDEPENDENT_BLOCKS = 0x01;
+static constexpr uint8_t FLAG_NO_MTF = 0x02;
+// The stream is the concatenation of several files; their directory
+// follows the block index.
+static constexpr uint8_t FLAG_PACKED = 0x04;
+
+// How a block's payload is coded. The id is stored in the block header.
+enum class BlockType : uint8_t {
+    // Filter, BWT, MTF/RLE and the context-mixing coder.
+    Bwt = 0,
+    // The block's bytes as they are.
+    Stored = 1,
+    // lzCompress output; no models involved.
+    Lz = 2,
+};
+
+// crc is the CRC-32C of the original block bytes. rleCount, filter, noMtf
+// and primaries are only used by BWT blocks; noMtf is stored as the high
+// bit of the filter byte.
+struct BlockHeader {
+    uint64_t blockLen = 0;
+    BlockType type = BlockType::Bwt;
+    uint64_t compSize = 0;
+    uint32_t crc = 0;
+    uint64_t rleCount = 0;
+    BlockFilter filter = BlockFilter::None;
+    bool noMtf = false;
+    std::vector<uint64_t> primaries;
+};
+
+static constexpr uint8_t BLOCK_NO_MTF = 0x80;
+
+// Whether BWT blocks go through MTF/RLE: always, never, or as a trial on
+// each block decides. Blocks that skip it by choice say so in their header.
+enum class MtfMode { On, Off, Choose };
+
+// LEB128: seven bits per byte, low bits first, the high bit set on all but
+// the last byte.
+static void putVarint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(uint8_t(v | 0x80));
+        v >>= 7;
     }
-    return { last, primary };
+    out.push_back(uint8_t(v));
 }
 
-static std::vector<uint8_t> mtfEncode(const std::string& bwt) {
-    std::vector<uint8_t> symbols(256);
-    std::iota(symbols.begin(), symbols.end(), 0);
-    std::vector<uint8_t> out;
-    out.reserve(bwt.size());
-    for (unsigned char c : bwt) {
-        auto it = std::find(symbols.begin(), symbols.end(), c);
-        int idx = int(it - symbols.begin());
-        out.push_back(idx);
-        symbols.erase(it);
-        symbols.insert(symbols.begin(), c);
+template <typename Byte>
+static uint64_t decodeVarint(Byte&& byte) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t b = byte();
+        v |= uint64_t(b & 0x7F) << shift;
+        if (!(b & 0x80)) return v;
     }
+    throw std::runtime_error("Corrupt block");
+}
+
+// Lengths and primaries are varints, so small blocks keep small headers
+// and blocks past 4 GiB need no other layout.
+static std::vector<uint8_t> blockHeaderBytes(const BlockHeader& h) {
+    std::vector<uint8_t> out;
+    putVarint(out, h.blockLen);
+    out.push_back(uint8_t(h.type));
+    putVarint(out, h.compSize);
+    out.resize(out.size() + sizeof(h.crc));
+    std::memcpy(&out[out.size() - sizeof(h.crc)], &h.crc, sizeof(h.crc));
+    if (h.type != BlockType::Bwt) return out;
+    putVarint(out, h.rleCount);
+    out.push_back(uint8_t(uint8_t(h.filter) | (h.noMtf ? BLOCK_NO_MTF : 0)));
+    out.push_back(uint8_t(h.primaries.size()));
+    for (uint64_t p : h.primaries) putVarint(out, p);
     return out;
 }
 
-static std::vector<uint8_t> rleZero(const std::vector<uint8_t>& mtf) {
+// Bytes sampled from a block to choose its type: the whole block when
+// small, otherwise chunks spread evenly over it.
+static constexpr size_t SAMPLE_CHUNK = 4096;
+static constexpr size_t SAMPLE_CHUNKS = 16;
+
+static std::vector<uint8_t> sampleBlock(const uint8_t* data, size_t n) {
+    if (n <= SAMPLE_CHUNK * SAMPLE_CHUNKS) return std::vector<uint8_t>(data, data + n);
+    std::vector<uint8_t> sample;
+    sample.reserve(SAMPLE_CHUNK * SAMPLE_CHUNKS);
+    for (size_t k = 0; k < SAMPLE_CHUNKS; ++k) {
+        const uint8_t* p = data + (n - SAMPLE_CHUNK) / (SAMPLE_CHUNKS - 1) * k;
+        sample.insert(sample.end(), p, p + SAMPLE_CHUNK);
+    }
+    return sample;
+}
+
+// Order-0 entropy in bits per byte, with the Miller-Madow correction so
+// that small samples of random data still come out near 8.
+static double byteEntropy(const std::vector<uint8_t>& sample) {
+    size_t count[256] = {};
+    for (uint8_t c : sample) ++count[c];
+    double h = 0;
+    size_t seen = 0;
+    for (size_t c : count) {
+        if (!c) continue;
+        double q = double(c) / double(sample.size());
+        h -= q * std::log2(q);
+        ++seen;
+    }
+    return h + double(seen - 1) / (2 * std::log(2.0) * double(sample.size()));
+}
+
+// Blocks below the level's entropy threshold take the full pipeline. Above
+// it the models have little left to find, so a block is LZ-coded when a
+// trial on the sample finds repeats worth 1/16 of it, and stored otherwise.
+static BlockType chooseBlockType(const uint8_t* data, size_t n, double fastEntropy) {
+    if (n == 0) return BlockType::Bwt;
+    std::vector<uint8_t> sample = sampleBlock(data, n);
+    if (byteEntropy(sample) < fastEntropy) return BlockType::Bwt;
+    size_t lz = lzCompress(sample.data(), sample.size()).size();
+    return lz <= sample.size() - sample.size() / 16 ? BlockType::Lz : BlockType::Stored;
+}
+
+// Stored and LZ blocks; an LZ block that would not shrink is stored.
+static std::vector<uint8_t> encodeFastBlock(const uint8_t* data, size_t n, BlockType type) {
+    std::vector<uint8_t> payload;
+    if (type == BlockType::Lz) {
+        payload = lzCompress(data, n);
+        if (payload.size() >= n) type = BlockType::Stored;
+    }
+    BlockHeader h;
+    h.blockLen = n;
+    h.type = type;
+    h.compSize = type == BlockType::Stored ? n : payload.size();
+    h.crc = crc32c(data, n);
+    std::vector<uint8_t> record = blockHeaderBytes(h);
+    if (type == BlockType::Stored) record.insert(record.end(), data, data + n);
+    else record.insert(record.end(), payload.begin(), payload.end());
+    return record;
+}
+
+static std::string decodeFastBlock(const BlockHeader& h, const uint8_t* payload) {
+    std::string block;
+    if (h.type == BlockType::Stored) {
+        if (h.compSize != h.blockLen)
+            throw std::runtime_error("Corrupt block");
+        block.assign(reinterpret_cast<const char*>(payload), size_t(h.compSize));
+    }
+    else {
+        block = lzDecompress(payload, size_t(h.compSize), size_t(h.blockLen));
+    }
+    if (crc32c(block.data(), block.size()) != h.crc)
+        throw std::runtime_error("Checksum mismatch");
+    return block;
+}
+
+// Bytes of BWT output, from the middle of a block, coded both ways to
+// choose MTF; small fresh models predict the choice for the block well.
+static constexpr size_t MTF_TRIAL_BYTES = 16 * 1024;
+static constexpr size_t MTF_TRIAL_TABLE = size_t(1) << 18;
+using MtfTrialPipeline = ModelPipelineFor<LEVELS[2].models>;
+
+static size_t trialSize(const std::vector<uint8_t>& symbols) {
+    MtfTrialPipeline ms(MTF_TRIAL_TABLE);
     std::vector<uint8_t> out;
-    for (size_t i = 0; i < mtf.size();) {
-        if (mtf[i] == 0) {
-            size_t run = 1;
-            while (i + run < mtf.size() && mtf[i + run] == 0 && run < 255) ++run;
-            out.push_back(0);
-            out.push_back(static_cast<uint8_t>(run));
-            i += run;
-        }
-        else {
-            out.push_back(mtf[i++]);
+    RangeCoder coder(out);
+    for (uint8_t byte : symbols) {
+        for (int b = 7; b >= 0; --b) {
+            int bit = (byte >> b) & 1;
+            coder.encode(bit, ms.predict());
+            ms.update(bit);
         }
     }
-    return out;
+    coder.finish();
+    return out.size();
 }
 
-static std::vector<uint8_t> rleZeroDecode(const std::vector<uint8_t>& rle) {
-    std::vector<uint8_t> out;
-    for (size_t i = 0; i < rle.size();) {
-        if (rle[i] == 0 && i + 1 < rle.size()) {
-            size_t run = rle[i + 1];
-            out.insert(out.end(), run, 0);
-            i += 2;
+static bool preferMtf(const std::string& bwtLast) {
+    size_t len = std::min(MTF_TRIAL_BYTES, bwtLast.size());
+    std::string slice = bwtLast.substr((bwtLast.size() - len) / 2, len);
+    return trialSize(rleZero(mtfEncode(slice))) <= trialSize(std::vector<uint8_t>(slice.begin(), slice.end()));
+}
+
+// Returns the complete block record: header fields followed by the payload,
+// which the range coder appends in place. When the models are thrown away
+// after this block, one that came out larger than its input is stored
+// instead; shared models would have to forget it, so those blocks stay.
+// Without MTF the BWT output is coded as is, so the models see contexts
+// in BWT order rather than move-to-front ranks. Blocks that choose leave
+// out the Words filter, which only pays without MTF.
+template <typename Pipeline>
+static std::vector<uint8_t> encodeBlock(const uint8_t* data, size_t n, Pipeline& ms, MtfMode mtfMode,
+    bool preprocess, size_t bwtMemory, bool disposable, stats::Sink* sink) {
+    stats::Stages stages(sink);
+    BlockFilter filter = BlockFilter::None;
+    std::string filtered;
+    const uint8_t* src = data;
+    size_t len = n;
+    if (preprocess) {
+        filtered = filterBlock(data, n, mtfMode == MtfMode::Off, filter);
+        if (filter != BlockFilter::None && filtered.size() <= n + FILTER_HEADER_MAX
+            && filtered.size() <= Compressor::MAX_BLOCK_SIZE) {
+            src = reinterpret_cast<const uint8_t*>(filtered.data());
+            len = filtered.size();
         }
         else {
-            out.push_back(rle[i++]);
+            filter = BlockFilter::None;
         }
+        stages.done(&CompressorStats::filter, n, len);
     }
-    return out;
+    auto [bwtLast, primaries] = bwtTransform(src, len, bwtStreamsFor(len), bwtMemory);
+    stages.done(&CompressorStats::bwt, len, bwtLast.size());
+    bool mtf = mtfMode == MtfMode::On || (mtfMode == MtfMode::Choose && preferMtf(bwtLast));
+    std::vector<uint8_t> rle;
+    if (mtf) {
+        std::vector<uint8_t> ranks = mtfEncode(bwtLast);
+        stages.done(&CompressorStats::mtf, bwtLast.size(), ranks.size());
+        rle = rleZero(ranks);
+        stages.done(&CompressorStats::rle, ranks.size(), rle.size());
+    }
+    else {
+        rle.assign(bwtLast.begin(), bwtLast.end());
+    }
+    std::vector<uint8_t> record;
+    record.reserve(rle.size() / 2 + 256);
+    RangeCoder coder(record);
+    for (uint8_t byte : rle) {
+        for (int b = 7; b >= 0; --b) {
+            int bit = (byte >> b) & 1;
+            uint16_t p = ms.predict();
+            stages.code([&] { coder.encode(bit, p); });
+            ms.update(bit);
+        }
+    }
+    coder.finish();
+    stages.coded(ms, rle.size(), rle.size(), record.size());
+    stages.finish();
+    if (disposable && record.size() >= n) return encodeFastBlock(data, n, BlockType::Stored);
+    BlockHeader h;
+    h.blockLen = n;
+    h.compSize = record.size();
+    h.crc = crc32c(data, n);
+    h.rleCount = rle.size();
+    h.filter = filter;
+    h.noMtf = mtfMode == MtfMode::Choose && !mtf;
+    h.primaries = primaries;
+    std::vector<uint8_t> header = blockHeaderBytes(h);
+    record.insert(record.begin(), header.begin(), header.end());
+    return record;
 }
 
-static std::string mtfDecode(const std::vector<uint8_t>& mtf) {
-    std::vector<uint8_t> symbols(256);
-    std::iota(symbols.begin(), symbols.end(), 0);
-    std::string out;
-    out.reserve(mtf.size());
-    for (auto idx : mtf) {
-        uint8_t c = symbols[idx];
-        out.push_back(static_cast<char>(c));
-        symbols.erase(symbols.begin() + idx);
-        symbols.insert(symbols.begin(), c);
+template <typename Pipeline>
+static std::string decodeBlock(const BlockHeader& h, const uint8_t* payload, Pipeline& ms, bool mtf,
+    size_t bwtMemory, stats::Sink* sink) {
+    stats::Stages stages(sink);
+    RangeDecoder dec(payload, size_t(h.compSize));
+    std::vector<uint8_t> rle(size_t(h.rleCount));
+    for (size_t i = 0; i < rle.size(); ++i) {
+        uint32_t c = 1;
+        while (c < 256) {
+            uint16_t p = ms.predict();
+            int bit;
+            stages.code([&] { bit = dec.decode(p); });
+            ms.update(bit);
+            c = (c << 1) | uint32_t(bit);
+        }
+        rle[i] = uint8_t(c);
     }
-    return out;
+    stages.coded(ms, rle.size(), h.compSize, rle.size());
+    std::string bwt;
+    if (mtf && !h.noMtf) {
+        std::vector<uint8_t> ranks = rleZeroDecode(rle);
+        stages.done(&CompressorStats::rle, rle.size(), ranks.size());
+        bwt = mtfDecode(ranks);
+        stages.done(&CompressorStats::mtf, ranks.size(), bwt.size());
+    }
+    else {
+        bwt.assign(rle.begin(), rle.end());
+    }
+    std::string filtered = bwtInverse(bwt, h.primaries, bwtMemory);
+    stages.done(&CompressorStats::bwt, bwt.size(), filtered.size());
+    auto block = unfilterBlock(h.filter, filtered);
+    if (h.filter != BlockFilter::None) stages.done(&CompressorStats::filter, filtered.size(), block.size());
+    if (block.size() != h.blockLen)
+        throw std::runtime_error("Corrupt block");
+    if (crc32c(block.data(), block.size()) != h.crc)
+        throw std::runtime_error("Checksum mismatch");
+    stages.finish();
+    return block;
 }
 
-static std::string bwtInverse(const std::string& last, uint32_t primary) {
-    int n = int(last.size());
-    std::vector<int> count(256, 0), pos(256, 0), next(n);
+// Checksum of a whole archive: CRC-32C over each block's length and
+// checksum in order, so dropped, repeated or reordered blocks are caught
+// without a second pass over the data.
+class StreamChecksum {
+    uint32_t crc = 0;
+public:
+    void add(uint64_t blockLen, uint32_t blockCrc) {
+        uint32_t v[3] = { uint32_t(blockLen), uint32_t(blockLen >> 32), blockCrc };
+        crc = crc32c(v, sizeof(v), crc);
+    }
+    uint32_t value() const { return crc; }
+};
+
+// Sequential reader over an in-memory archive.
+class ArchiveReader {
+    const uint8_t* p;
+    const uint8_t* end;
+public:
+    ArchiveReader(const uint8_t* data, size_t size) : p(data), end(data + size) {}
 
-    for (unsigned char c : last) ++count[c];
-    for (int c = 1; c < 256; ++c)
-        pos[c] = pos[c - 1] + count[c - 1];
+    bool atEnd() const { return p == end; }
+    const uint8_t* position() const { return p; }
 
-    for (int i = 0; i < n; ++i) {
-        unsigned char c = last[i];
-        next[pos[c]++] = i;
+    const uint8_t* take(size_t n) {
+        if (size_t(end - p) < n) throw std::runtime_error("Truncated archive");
+        const uint8_t* r = p;
+        p += n;
+        return r;
     }
 
-    int idx = next[primary];
-    std::string out(n, '\0');
-    for (int i = 0; i < n; ++i) {
-        out[i] = last[idx];
-        idx = next[idx];
+    template <typename T>
+    T get() {
+        T v;
+        std::memcpy(&v, take(sizeof(v)), sizeof(v));
+        return v;
     }
-    return out;
-}
 
-class IModel {
-public:
-    virtual ~IModel() = default;
-    virtual uint16_t predict() const = 0;
-    virtual void updateBit(int bit) = 0;
-    virtual void updateByte(uint8_t b) = 0;
+    uint64_t varint() { return decodeVarint([this] { return get<uint8_t>(); }); }
 };
 
-class ByteContextModel : public IModel {
-    size_t order;
-    std::unordered_map<uint32_t, std::pair<uint32_t, uint32_t>> table;
-    std::deque<uint8_t> history;
+// Sequential reader over an archive stream, counting the bytes it reads.
+class StreamReader {
+    std::istream& in;
+    uint64_t count = 0;
 public:
-    explicit ByteContextModel(size_t ord)
-        : order(ord) {
-    }
-
-    uint16_t predict() const override {
-        if (history.size() < order) return 0x8000;
-        uint32_t key = 0;
-        for (auto b : history) key = (key << 8) | b;
-        auto it = table.find(key);
-        uint32_t c0 = 1, c1 = 1;
-        if (it != table.end()) {
-            c0 = it->second.first + 1;
-            c1 = it->second.second + 1;
-        }
-        return static_cast<uint16_t>((uint64_t(c1) * 0xFFFF) / (c0 + c1));
+    explicit StreamReader(std::istream& s) : in(s) {}
+
+    uint64_t consumed() const { return count; }
+
+    void read(void* p, size_t n) {
+        if (!in.read(static_cast<char*>(p), std::streamsize(n)))
+            throw std::runtime_error("Truncated archive");
+        count += n;
+    }
+
+    template <typename T>
+    T get() {
+        T v;
+        read(&v, sizeof(v));
+        return v;
     }
 
-    void updateBit(int bit) override {
-        if (history.size() < order) return;
-        uint32_t key = 0;
-        for (auto b : history) key = (key << 8) | b;
-        auto& entry = table[key];
-        if (bit) ++entry.second;
-        else     ++entry.first;
+    uint64_t varint() { return decodeVarint([this] { return get<uint8_t>(); }); }
+};
+
+// Returns false at the end marker, a zero block length, that follows the
+// last block; h.crc then holds the stream checksum.
+template <typename Reader>
+static bool readBlockHeader(Reader& in, BlockHeader& h) {
+    h.blockLen = in.varint();
+    if (h.blockLen == 0) {
+        h.crc = in.template get<uint32_t>();
+        return false;
     }
+    h.type = BlockType(in.template get<uint8_t>());
+    if (h.type > BlockType::Lz || h.blockLen > Compressor::MAX_BLOCK_SIZE)
+        throw std::runtime_error("Corrupt block");
+    h.compSize = in.varint();
+    h.crc = in.template get<uint32_t>();
+    h.rleCount = 0;
+    h.filter = BlockFilter::None;
+    h.noMtf = false;
+    h.primaries.clear();
+    if (h.type != BlockType::Bwt) return true;
+    h.rleCount = in.varint();
+    // A filtered block exceeds the block by at most a Columns header, and
+    // zero-run coding at most doubles it. Checked before decodeBlock sizes
+    // its buffer, since the block's CRC can only be checked after that.
+    if (h.rleCount > 2 * (h.blockLen + FILTER_HEADER_MAX))
+        throw std::runtime_error("Corrupt block");
+    uint8_t filterByte = in.template get<uint8_t>();
+    h.noMtf = filterByte & BLOCK_NO_MTF;
+    h.filter = BlockFilter(filterByte & ~BLOCK_NO_MTF);
+    if (h.filter > BlockFilter::Words)
+        throw std::runtime_error("Corrupt block");
+    h.primaries.resize(in.template get<uint8_t>());
+    if (h.primaries.empty() || h.primaries.size() > BWT_MAX_STREAMS)
+        throw std::runtime_error("Corrupt block");
+    for (auto& p : h.primaries) p = in.varint();
+    return true;
+}
+
+// Returns a pointer to the block's payload inside the archive, or nullptr
+// once every block has been read.
+static const uint8_t* readBlock(ArchiveReader& in, BlockHeader& h) {
+    if (!readBlockHeader(in, h)) return nullptr;
+    return in.take(size_t(h.compSize));
+}
+
+// MAX_TABLE_BITS caps modelMemory at 2 GiB, so headers asking for more
+// are rejected as corrupt instead of allocated.
+static constexpr uint8_t MIN_TABLE_BITS = 16;
+static constexpr uint8_t MAX_TABLE_BITS = 31;
+static_assert(LEVELS[Compressor::MAX_LEVEL].tableBits <= MAX_TABLE_BITS, "every level's table can be recorded");
+
+static uint8_t tableBitsFor(size_t bytes) {
+    uint8_t bits = MIN_TABLE_BITS;
+    while (bits < MAX_TABLE_BITS && (size_t(1) << (bits + 1)) <= bytes) ++bits;
+    return bits;
+}
+
+// Every worker holds a block's models, so the pool never outnumbers the
+// blocks there are to code, when known, or MAX_THREADS.
+static unsigned resolveThreads(unsigned threads, uint64_t blocks = ~uint64_t(0)) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, Compressor::MAX_THREADS);
+    return unsigned(std::max<uint64_t>(1, std::min<uint64_t>(threads, blocks)));
+}
 
-    void updateByte(uint8_t b) override {
-        if (history.size() == order) history.pop_front();
-        history.push_back(b);
+// Runs the tasks from produce() in submission order on the pool, keeping at
+// most 2 * threads results in flight, and hands the results to sink in order.
+// produce() is not called again once it has returned an empty task.
+template <typename Produce, typename Sink>
+static void runOrdered(ThreadPool& pool, Produce&& produce, Sink&& sink) {
+    using Task = decltype(produce());
+    using Result = decltype(std::declval<Task&>()());
+    std::deque<std::future<Result>> inFlight;
+    const size_t window = size_t(pool.size()) * 2;
+    bool done = false;
+    for (;;) {
+        while (!done && inFlight.size() < window) {
+            auto task = produce();
+            if (!task) done = true;
+            else inFlight.push_back(pool.submit(std::move(task)));
+        }
+        if (inFlight.empty()) break;
+        sink(inFlight.front().get());
+        inFlight.pop_front();
     }
+}
+
+// A run of input or archive bytes. owner keeps the bytes alive when they
+// were read from a stream; for mapped files it is empty.
+struct ByteView {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    std::shared_ptr<std::vector<uint8_t>> owner;
 };
 
-class BitContextModel : public IModel {
-    size_t order;
-    std::unordered_map<uint32_t, std::pair<uint32_t, uint32_t>> table;
-    std::deque<bool> history;
-public:
-    explicit BitContextModel(size_t ord)
-        : order(ord) {
-    }
-
-    uint16_t predict() const override {
-        if (history.size() < order) return 0x8000;
-        uint32_t key = 0;
-        for (bool b : history) key = (key << 1) | (b ? 1 : 0);
-        auto it = table.find(key);
-        uint32_t c0 = 1, c1 = 1;
-        if (it != table.end()) {
-            c0 = it->second.first + 1;
-            c1 = it->second.second + 1;
+// dictionary is the id of the dictionary the models were primed with, 0
+// for none.
+struct StreamHeader {
+    uint8_t flags = 0;
+    uint8_t tableBits = 0;
+    uint8_t level = 0;
+    uint64_t fullSize = 0;
+    uint32_t dictionary = 0;
+};
+
+static constexpr uint64_t UNKNOWN_SIZE = ~uint64_t(0);
+static constexpr size_t STREAM_HEADER_SIZE = 6 + sizeof(uint64_t) + sizeof(uint32_t);
+
+// Where a block starts in the original data and in the archive.
+struct IndexEntry {
+    uint64_t rawOffset;
+    uint64_t archiveOffset;
+
+    bool operator==(const IndexEntry& o) const { return rawOffset == o.rawOffset && archiveOffset == o.archiveOffset; }
+};
+static_assert(sizeof(IndexEntry) == 2 * sizeof(uint64_t), "IndexEntry is written as is");
+
+static constexpr char INDEX_MAGIC[4] = { 'Z', 'B', 'I', 'X' };
+static constexpr size_t TRAILER_SIZE = sizeof(uint64_t) + sizeof(INDEX_MAGIC);
+
+// After the last block: the end marker, the stream checksum, the entry
+// count and one entry per block plus a final one for the end of the data,
+// then a trailer with the position of the end marker, so readers can find
+// the index from the end.
+template <typename Write>
+static void writeIndex(const std::vector<IndexEntry>& index, uint32_t streamCrc, Write&& write) {
+    // A block length of 0 as a varint.
+    uint8_t endMarker = 0;
+    uint64_t count = index.size();
+    uint64_t indexPos = index.back().archiveOffset;
+    write(&endMarker, sizeof(endMarker));
+    write(&streamCrc, sizeof(streamCrc));
+    write(&count, sizeof(count));
+    write(index.data(), index.size() * sizeof(IndexEntry));
+    write(&indexPos, sizeof(indexPos));
+    write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+}
+
+static std::vector<IndexEntry> readIndex(const uint8_t* data, size_t size) {
+    if (size < STREAM_HEADER_SIZE + TRAILER_SIZE
+        || !std::equal(INDEX_MAGIC, INDEX_MAGIC + sizeof(INDEX_MAGIC), data + size - sizeof(INDEX_MAGIC)))
+        throw std::runtime_error("Archive has no index");
+    uint64_t indexPos;
+    std::memcpy(&indexPos, data + size - TRAILER_SIZE, sizeof(indexPos));
+    if (indexPos < STREAM_HEADER_SIZE || indexPos > size - TRAILER_SIZE)
+        throw std::runtime_error("Corrupt index");
+    ArchiveReader in(data + indexPos, size - TRAILER_SIZE - size_t(indexPos));
+    uint64_t endMarker = in.varint();
+    in.take(sizeof(uint32_t));
+    uint64_t count = in.get<uint64_t>();
+    if (endMarker != 0 || count == 0 || count > size / sizeof(IndexEntry))
+        throw std::runtime_error("Corrupt index");
+    std::vector<IndexEntry> index(static_cast<size_t>(count));
+    std::memcpy(index.data(), in.take(index.size() * sizeof(IndexEntry)), index.size() * sizeof(IndexEntry));
+    bool ok = in.atEnd() && index[0].rawOffset == 0 && index[0].archiveOffset == STREAM_HEADER_SIZE
+        && index.back().archiveOffset == indexPos;
+    for (size_t i = 1; ok && i < index.size(); ++i)
+        ok = index[i].rawOffset > index[i - 1].rawOffset && index[i].archiveOffset > index[i - 1].archiveOffset;
+    if (!ok)
+        throw std::runtime_error("Corrupt index");
+    return index;
+}
+
+static uint32_t dictionaryId(const std::string& dict) {
+    if (dict.empty()) return 0;
+    uint32_t id = crc32c(dict.data(), dict.size());
+    return id ? id : 1;
+}
+
+// The dictionary as the models would see it in a block: its BWT, through
+// MTF/RLE when the stream uses them.
+static std::vector<uint8_t> primingSymbols(const std::string& dict, bool mtf) {
+    if (dict.empty()) return {};
+    auto [bwtLast, primaries] = bwtTransform(reinterpret_cast<const uint8_t*>(dict.data()), dict.size(), 1);
+    return mtf ? rleZero(mtfEncode(bwtLast)) : std::vector<uint8_t>(bwtLast.begin(), bwtLast.end());
+}
+
+// Trains fresh models on the priming symbols, exactly as coding them would,
+// so encoder and decoder start from the same state.
+template <typename Pipeline>
+static void prime(Pipeline& ms, const std::vector<uint8_t>& symbols) {
+    for (uint8_t byte : symbols) {
+        for (int b = 7; b >= 0; --b) {
+            ms.predict();
+            ms.update((byte >> b) & 1);
+        }
+    }
+#ifdef ZEROBIT_STATS
+    CompressorStats discarded;
+    ms.collect(discarded);
+#endif
+}
+
+struct CompressorContext::State {
+    int level = 0;
+    size_t tableBytes = 0;
+    // One pipeline per thread that codes blocks; the calling thread uses
+    // the first, pool workers the one at their index.
+    std::vector<std::shared_ptr<void>> pipelines;
+};
+
+CompressorContext::CompressorContext()
+    : state(std::make_unique<State>()) {
+}
+
+CompressorContext::~CompressorContext() = default;
+
+void CompressorContext::release() {
+    *state = State();
+}
+
+struct ContextAccess {
+    // Drops models kept for another level or size and makes room for
+    // slots pipelines. Called before a pool starts, so workers taking
+    // their own slot never change the context's shape.
+    static void reserve(CompressorContext& ctx, int level, size_t tableBytes, size_t slots) {
+        CompressorContext::State& s = *ctx.state;
+        if (s.level != level || s.tableBytes != tableBytes) {
+            s = CompressorContext::State();
+            s.level = level;
+            s.tableBytes = tableBytes;
         }
-        return static_cast<uint16_t>((uint64_t(c1) * 0xFFFF) / (c0 + c1));
+        if (s.pipelines.size() < slots) s.pipelines.resize(slots);
     }
 
-    void updateBit(int bit) override {
-        if (history.size() < order) {
-            history.push_back(bit);
-            return;
+    // Models in their freshly constructed state: the ones in the context's
+    // slot, reset, when it holds some, otherwise new ones, which the
+    // context then keeps. Each level has one pipeline type.
+    template <typename Pipeline>
+    static std::shared_ptr<Pipeline> pipeline(CompressorContext* ctx, int level, size_t tableBytes, size_t slot = 0) {
+        if (!ctx) return std::make_shared<Pipeline>(tableBytes);
+        reserve(*ctx, level, tableBytes, slot + 1);
+        std::shared_ptr<void>& kept = ctx->state->pipelines[slot];
+        if (kept) {
+            auto ms = std::static_pointer_cast<Pipeline>(kept);
+            ms->reset();
+            return ms;
         }
-        uint32_t key = 0;
-        for (bool b : history) key = (key << 1) | (b ? 1 : 0);
-        auto& entry = table[key];
-        if (bit) ++entry.second;
-        else     ++entry.first;
-        history.pop_front();
-        history.push_back(bit);
+        auto ms = std::make_shared<Pipeline>(tableBytes);
+        kept = ms;
+        return ms;
     }
+};
 
-    void updateByte(uint8_t) override {
+// Passes finished blocks to opts.progress and stops the run when it asks to.
+class Progress {
+    const CompressorOptions& opts;
+    uint64_t done = 0;
+    uint64_t total;
+public:
+    Progress(const CompressorOptions& o, uint64_t fullSize)
+        : opts(o), total(fullSize == UNKNOWN_SIZE ? 0 : fullSize) {}
+
+    void add(uint64_t bytes) {
+        done += bytes;
+        if (opts.progress && !opts.progress(done, total))
+            throw Compressor::Cancelled();
     }
 };
 
-class MatchModel : public IModel {
-    const size_t contextSize;
-    static constexpr size_t WINDOW_SIZE = 1 << 20;
+// The stream header for coding with opts. Blocks get fresh models when
+// independent is set.
+static StreamHeader streamHeaderFor(const CompressorOptions& opts, uint64_t fullSize, uint8_t flags,
+    bool independent) {
+    const LevelParams& lp = levelParams(opts.level);
+    StreamHeader sh;
+    sh.flags = flags;
+    if (independent) sh.flags |= FLAG_INDEPENDENT_BLOCKS;
+    if (!(lp.mtf && opts.mtf)) sh.flags |= FLAG_NO_MTF;
+    sh.tableBits = opts.modelMemory ? tableBitsFor(opts.modelMemory) : lp.tableBits;
+    sh.level = uint8_t(opts.level);
+    sh.fullSize = fullSize;
+    sh.dictionary = dictionaryId(opts.dictionary);
+    return sh;
+}
 
-    std::vector<uint8_t> buffer;
-    size_t bufPos = 0;
+template <typename Write>
+static void writeStreamHeader(const StreamHeader& sh, Write&& write) {
+    uint8_t header[] = { uint8_t(MAGIC[0]), uint8_t(MAGIC[1]), FORMAT_VERSION, sh.flags, sh.tableBits, sh.level };
+    write(header, sizeof(header));
+    write(&sh.fullSize, sizeof(sh.fullSize));
+    write(&sh.dictionary, sizeof(sh.dictionary));
+}
 
-    std::unordered_map<uint64_t, size_t> lastPos;
-    size_t matchPos = std::string::npos;
-    int matchLen = 0;
-    int bitPos = 0;
+static void checkDictionary(const StreamHeader& sh, const CompressorOptions& opts) {
+    if (sh.dictionary && opts.dictionary.empty())
+        throw std::runtime_error("Archive needs a dictionary");
+    if (sh.dictionary && sh.dictionary != dictionaryId(opts.dictionary))
+        throw std::runtime_error("Wrong dictionary");
+}
 
+// The block index and stream checksum of an archive being written, fed
+// each block record in order.
+class RecordLog {
+    std::vector<IndexEntry> index{ { 0, STREAM_HEADER_SIZE } };
+    StreamChecksum sum;
 public:
-    MatchModel(size_t ctxSize = 4)
-        : contextSize(ctxSize), buffer(WINDOW_SIZE, 0) {
+    // Returns the block's original length.
+    uint64_t add(const std::vector<uint8_t>& record) {
+        ArchiveReader r(record.data(), record.size());
+        BlockHeader h;
+        readBlockHeader(r, h);
+        sum.add(h.blockLen, h.crc);
+        index.push_back({ index.back().rawOffset + h.blockLen, index.back().archiveOffset + record.size() });
+        return h.blockLen;
+    }
+
+    template <typename Write>
+    void finish(Write&& write) const {
+        writeIndex(index, sum.value(), write);
     }
+};
 
-    uint16_t predict() const override {
-        if (matchPos == std::string::npos || matchLen < 1)
-            return 32768;
+using BlockEncoder = std::function<std::vector<uint8_t>(const uint8_t* data, size_t n)>;
+using BlockDecoder = std::function<std::string(const BlockHeader& h, const uint8_t* payload)>;
 
-        uint8_t nextByte = buffer[(matchPos + matchLen) % WINDOW_SIZE];
-        int nextBit = (nextByte >> (7 - bitPos)) & 1;
+// Code the blocks of one stream in order on the calling thread. The models
+// carry over from block to block unless the header asks for fresh ones;
+// stored and LZ blocks leave them alone.
+static MtfMode mtfModeFor(const StreamHeader& sh) {
+    if (sh.flags & FLAG_NO_MTF) return MtfMode::Off;
+    return levelParams(sh.level).chooseMtf ? MtfMode::Choose : MtfMode::On;
+}
+
+static BlockEncoder sequentialEncoder(const StreamHeader& sh, const CompressorOptions& opts, stats::Sink* sink) {
+    bool mtf = !(sh.flags & FLAG_NO_MTF);
+    MtfMode mtfMode = mtfModeFor(sh);
+    bool independent = sh.flags & FLAG_INDEPENDENT_BLOCKS;
+    bool preprocess = opts.preprocess;
+    size_t bwtMemory = opts.bwtMemory;
+    double fastEntropy = opts.fastBlocks ? levelParams(sh.level).fastEntropy : HUGE_VAL;
+    CompressorContext* context = opts.context;
+    int level = sh.level;
+    size_t tableBytes = size_t(1) << sh.tableBits;
+    auto priming = std::make_shared<const std::vector<uint8_t>>(primingSymbols(opts.dictionary, mtf));
+    BlockEncoder encode;
+    withModelPipeline(level, [&](auto tag) {
+        using Pipeline = typename decltype(tag)::type;
+        encode = [=, ms = std::shared_ptr<Pipeline>()](const uint8_t* data, size_t n) mutable {
+            BlockType type = chooseBlockType(data, n, fastEntropy);
+            if (type != BlockType::Bwt) return encodeFastBlock(data, n, type);
+            if (!ms || independent) {
+                ms = nullptr;
+                ms = ContextAccess::pipeline<Pipeline>(context, level, tableBytes);
+                prime(*ms, *priming);
+            }
+            return encodeBlock(data, n, *ms, mtfMode, preprocess, bwtMemory, independent, sink);
+        };
+    });
+    return encode;
+}
 
-        int confidence;
-        if (matchLen == 1)        confidence = 256;
-        else if (matchLen == 2)   confidence = 1024;
-        else if (matchLen == 3)   confidence = 4096;
-        else                      confidence = 8192;
+static BlockDecoder sequentialDecoder(const StreamHeader& sh, const CompressorOptions& opts, stats::Sink* sink) {
+    bool mtf = !(sh.flags & FLAG_NO_MTF);
+    bool independent = sh.flags & FLAG_INDEPENDENT_BLOCKS;
+    size_t bwtMemory = opts.bwtMemory;
+    CompressorContext* context = opts.context;
+    int level = sh.level;
+    size_t tableBytes = size_t(1) << sh.tableBits;
+    auto priming = std::make_shared<const std::vector<uint8_t>>(
+        sh.dictionary ? primingSymbols(opts.dictionary, mtf) : std::vector<uint8_t>());
+    BlockDecoder decode;
+    withModelPipeline(level, [&](auto tag) {
+        using Pipeline = typename decltype(tag)::type;
+        decode = [=, ms = std::shared_ptr<Pipeline>()](const BlockHeader& h, const uint8_t* payload) mutable {
+            if (h.type != BlockType::Bwt) return decodeFastBlock(h, payload);
+            if (!ms || independent) {
+                ms = nullptr;
+                ms = ContextAccess::pipeline<Pipeline>(context, level, tableBytes);
+                prime(*ms, *priming);
+            }
+            return decodeBlock(h, payload, *ms, mtf, bwtMemory, sink);
+        };
+    });
+    return decode;
+}
 
-        int p = nextBit
-            ? 32768 + confidence
-            : 32768 - confidence;
+// next() returns each input block in turn and an empty view at the end;
+// write(data, size) receives the archive bytes in order.
+template <typename Next, typename Write>
+static void compressBlocks(Next&& next, Write&& write, uint64_t fullSize, const CompressorOptions& opts,
+    uint8_t flags = 0) {
+    // Asking for threads makes the blocks independent even when there are
+    // too few to share out, so the archive does not depend on the input size.
+    StreamHeader sh = streamHeaderFor(opts, fullSize, flags, resolveThreads(opts.threads) > 1 || opts.seekable);
+    unsigned threads = resolveThreads(opts.threads,
+        fullSize == UNKNOWN_SIZE ? fullSize : (fullSize + opts.blockSize - 1) / opts.blockSize);
+    writeStreamHeader(sh, write);
+    RecordLog log;
+    Progress progress(opts, fullSize);
+    stats::Sink statsSink(opts.stats);
+    stats::Sink* sink = opts.stats ? &statsSink : nullptr;
+    auto writeRecord = [&](const std::vector<uint8_t>& record) {
+        uint64_t blockLen = log.add(record);
+        write(record.data(), record.size());
+        progress.add(blockLen);
+    };
 
-        return static_cast<uint16_t>(std::clamp(p, 1, 65534));
+    if (threads == 1) {
+        BlockEncoder encode = sequentialEncoder(sh, opts, sink);
+        for (ByteView block = next(); block.size; block = next())
+            writeRecord(encode(block.data, block.size));
+    }
+    else {
+        bool mtf = !(sh.flags & FLAG_NO_MTF);
+        MtfMode mtfMode = mtfModeFor(sh);
+        bool preprocess = opts.preprocess;
+        double fastEntropy = opts.fastBlocks ? levelParams(sh.level).fastEntropy : HUGE_VAL;
+        int level = sh.level;
+        size_t tableBytes = size_t(1) << sh.tableBits;
+        const std::vector<uint8_t> priming = primingSymbols(opts.dictionary, mtf);
+        // Each worker resets its own models for every block it takes.
+        CompressorContext local;
+        CompressorContext* context = opts.context ? opts.context : &local;
+        ContextAccess::reserve(*context, level, tableBytes, threads);
+        withModelPipeline(level, [&](auto tag) {
+            using Pipeline = typename decltype(tag)::type;
+            ThreadPool pool(threads);
+            runOrdered(pool,
+                [&]() -> std::function<std::vector<uint8_t>()> {
+                    ByteView block = next();
+                    if (!block.size) return nullptr;
+                    return [block, context, level, tableBytes, mtfMode, preprocess, fastEntropy,
+                        bwtMemory = opts.bwtMemory, &priming, sink] {
+                        BlockType type = chooseBlockType(block.data, block.size, fastEntropy);
+                        if (type != BlockType::Bwt) return encodeFastBlock(block.data, block.size, type);
+                        auto ms = ContextAccess::pipeline<Pipeline>(context, level, tableBytes,
+                            size_t(ThreadPool::currentWorker()));
+                        prime(*ms, priming);
+                        return encodeBlock(block.data, block.size, *ms, mtfMode, preprocess, bwtMemory, true, sink);
+                    };
+                },
+                writeRecord);
+        });
     }
+    log.finish(write);
+}
 
-    void updateBit(int bit) override {
-        if (++bitPos == 8) {
-            bitPos = 0;
-            if (matchLen > 0 && matchPos != std::string::npos) {
-                matchPos = (matchPos + 1) % WINDOW_SIZE;
-                ++matchLen;
-                if (matchLen >= WINDOW_SIZE)
-                    matchLen = 0, matchPos = std::string::npos;
-            }
-        }
+static StreamHeader parseStreamHeader(const uint8_t* p) {
+    if (!std::equal(p, p + sizeof(MAGIC), MAGIC))
+        throw std::runtime_error("Not a ZeroBit archive");
+    if (p[2] != FORMAT_VERSION)
+        throw std::runtime_error("Unsupported format version");
+    StreamHeader sh;
+    sh.flags = p[3];
+    sh.tableBits = p[4];
+    sh.level = p[5];
+    if (sh.tableBits < MIN_TABLE_BITS || sh.tableBits > MAX_TABLE_BITS
+        || sh.level < Compressor::MIN_LEVEL || sh.level > Compressor::MAX_LEVEL)
+        throw std::runtime_error("Corrupt header");
+    std::memcpy(&sh.fullSize, p + 6, sizeof(sh.fullSize));
+    std::memcpy(&sh.dictionary, p + 6 + sizeof(sh.fullSize), sizeof(sh.dictionary));
+    return sh;
+}
+
+// next(h) fills in the next block header and returns its payload, or an
+// empty view once the archive is exhausted. blocks is how many there are,
+// when known.
+template <typename Next, typename Write>
+static void decompressBlocks(const StreamHeader& sh, Next&& next, Write&& write, const CompressorOptions& opts,
+    uint64_t blocks = ~uint64_t(0)) {
+    bool independent = sh.flags & FLAG_INDEPENDENT_BLOCKS;
+    unsigned threads = resolveThreads(opts.threads, blocks);
+    checkDictionary(sh, opts);
+    Progress progress(opts, sh.fullSize);
+    stats::Sink statsSink(opts.stats);
+    stats::Sink* sink = opts.stats ? &statsSink : nullptr;
+    auto writeBlock = [&](const std::string& block) {
+        write(block.data(), block.size());
+        progress.add(block.size());
+    };
+
+    if (!independent || threads == 1) {
+        BlockDecoder decode = sequentialDecoder(sh, opts, sink);
+        BlockHeader h;
+        for (ByteView payload = next(h); payload.data; payload = next(h))
+            writeBlock(decode(h, payload.data));
+    }
+    else {
+        int level = sh.level;
+        size_t tableBytes = size_t(1) << sh.tableBits;
+        bool mtf = !(sh.flags & FLAG_NO_MTF);
+        const std::vector<uint8_t> priming = sh.dictionary ? primingSymbols(opts.dictionary, mtf) : std::vector<uint8_t>();
+        CompressorContext local;
+        CompressorContext* context = opts.context ? opts.context : &local;
+        ContextAccess::reserve(*context, level, tableBytes, threads);
+        withModelPipeline(level, [&](auto tag) {
+            using Pipeline = typename decltype(tag)::type;
+            ThreadPool pool(threads);
+            runOrdered(pool,
+                [&]() -> std::function<std::string()> {
+                    BlockHeader h;
+                    ByteView payload = next(h);
+                    if (!payload.data) return nullptr;
+                    return [h, payload, context, level, tableBytes, mtf, bwtMemory = opts.bwtMemory, &priming, sink] {
+                        if (h.type != BlockType::Bwt) return decodeFastBlock(h, payload.data);
+                        auto ms = ContextAccess::pipeline<Pipeline>(context, level, tableBytes,
+                            size_t(ThreadPool::currentWorker()));
+                        prime(*ms, priming);
+                        return decodeBlock(h, payload.data, *ms, mtf, bwtMemory, sink);
+                    };
+                },
+                writeBlock);
+        });
     }
+}
 
-    void updateByte(uint8_t b) override {
-        buffer[bufPos] = b;
+static void checkOptions(const CompressorOptions& opts) {
+    if (opts.blockSize == 0 || opts.blockSize > Compressor::MAX_BLOCK_SIZE)
+        throw std::runtime_error("Invalid block size");
+    levelParams(opts.level);
+}
 
-        if (contextSize <= bufPos || bufPos >= contextSize) {
-            size_t base = bufPos >= contextSize
-                ? bufPos - contextSize
-                : WINDOW_SIZE + bufPos - contextSize;
+void Compressor::compress(const std::string& inPath, const std::string& outPath, const CompressorOptions& opts) {
+    namespace fs = std::filesystem;
+    checkOptions(opts);
+    if (!opts.overwrite && fs::exists(outPath))
+        throw std::runtime_error("Output already exists");
+    MappedFile in(inPath);
+    FileSink out(outPath);
+    size_t pos = 0;
+    compressBlocks(
+        [&] {
+            ByteView v;
+            v.data = in.data() + pos;
+            v.size = std::min(opts.blockSize, in.size() - pos);
+            pos += v.size;
+            return v;
+        },
+        [&](const void* data, size_t n) { out.write(data, n); },
+        in.size(), opts);
+    out.close();
+}
 
-            uint64_t key = 0;
-            for (size_t i = 0; i < contextSize; ++i) {
-                key = (key << 8) | buffer[(base + i) % WINDOW_SIZE];
-            }
+void Compressor::compress(std::istream& in, std::ostream& out, const CompressorOptions& opts) {
+    checkOptions(opts);
+    compressBlocks(
+        [&] {
+            ByteView v;
+            v.owner = std::make_shared<std::vector<uint8_t>>(opts.blockSize);
+            in.read(reinterpret_cast<char*>(v.owner->data()), std::streamsize(opts.blockSize));
+            v.owner->resize(size_t(in.gcount()));
+            v.data = v.owner->data();
+            v.size = v.owner->size();
+            return v;
+        },
+        [&](const void* data, size_t n) { out.write(static_cast<const char*>(data), std::streamsize(n)); },
+        UNKNOWN_SIZE, opts);
+    if (!out.flush()) throw std::runtime_error("Write failed");
+}
 
-            auto it = lastPos.find(key);
-            if (it != lastPos.end()) {
-                matchPos = it->second;
-                matchLen = 1;
-                bitPos = 0;
+// Decodes every block of a mapped archive and hands the data to write in
+// order. Once the end marker is reached the stream checksum and the index
+// are checked against the blocks read.
+template <typename Write>
+static void decompressArchive(const uint8_t* data, size_t size, Write&& write, const CompressorOptions& opts) {
+    ArchiveReader in(data, size);
+    StreamHeader sh = parseStreamHeader(in.take(STREAM_HEADER_SIZE));
+    StreamChecksum sum;
+    std::vector<IndexEntry> seen{ { 0, STREAM_HEADER_SIZE } };
+    decompressBlocks(sh,
+        [&](BlockHeader& h) {
+            ByteView v;
+            v.data = readBlock(in, h);
+            v.size = v.data ? size_t(h.compSize) : 0;
+            if (v.data) {
+                sum.add(h.blockLen, h.crc);
+                seen.push_back({ seen.back().rawOffset + h.blockLen, uint64_t(in.position() - data) });
+                return v;
             }
-            else {
-                matchPos = std::string::npos;
-                matchLen = 0;
-                bitPos = 0;
+            if (h.crc != sum.value())
+                throw std::runtime_error("Checksum mismatch");
+            if (readIndex(data, size) != seen)
+                throw std::runtime_error("Corrupt index");
+            return v;
+        },
+        write, opts);
+}
+
+// Reads the rest of an archive after its end marker and stream checksum,
+// and checks the index against the blocks read.
+template <typename Reader>
+static void readStreamIndex(Reader& in, const std::vector<IndexEntry>& seen) {
+    uint64_t count = in.template get<uint64_t>();
+    if (count != seen.size())
+        throw std::runtime_error("Corrupt index");
+    std::vector<IndexEntry> index(seen.size());
+    in.read(index.data(), index.size() * sizeof(IndexEntry));
+    uint64_t indexPos = in.template get<uint64_t>();
+    char magic[sizeof(INDEX_MAGIC)];
+    in.read(magic, sizeof(magic));
+    if (index != seen || indexPos != seen.back().archiveOffset
+        || !std::equal(magic, magic + sizeof(magic), INDEX_MAGIC))
+        throw std::runtime_error("Corrupt index");
+}
+
+template <typename Write>
+static void decompressStream(std::istream& in, Write&& write, const CompressorOptions& opts) {
+    uint8_t header[STREAM_HEADER_SIZE];
+    if (!in.read(reinterpret_cast<char*>(header), sizeof(header)))
+        throw std::runtime_error("Not a ZeroBit archive");
+    StreamHeader sh = parseStreamHeader(header);
+    if (sh.flags & FLAG_PACKED)
+        throw std::runtime_error("Archive holds several files; unpack it from a file");
+    StreamChecksum sum;
+    std::vector<IndexEntry> seen{ { 0, STREAM_HEADER_SIZE } };
+    decompressBlocks(sh,
+        [&](BlockHeader& h) {
+            ByteView v;
+            StreamReader r(in);
+            if (!readBlockHeader(r, h)) {
+                if (h.crc != sum.value())
+                    throw std::runtime_error("Checksum mismatch");
+                readStreamIndex(r, seen);
+                return v;
             }
+            sum.add(h.blockLen, h.crc);
+            v.owner = std::make_shared<std::vector<uint8_t>>(size_t(h.compSize) + 1);
+            r.read(v.owner->data(), size_t(h.compSize));
+            seen.push_back({ seen.back().rawOffset + h.blockLen, seen.back().archiveOffset + r.consumed() });
+            v.data = v.owner->data();
+            v.size = size_t(h.compSize);
+            return v;
+        },
+        write, opts);
+}
+
+static constexpr char PACK_MAGIC[4] = { 'Z', 'B', 'P', 'K' };
+static constexpr size_t PACK_TRAILER_SIZE = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(PACK_MAGIC);
+
+// A multi-file archive is a stream over the files' concatenated bytes,
+// then the directory, its CRC-32C and a trailer with the directory's
+// position, which is also where the stream ends.
+struct PackedArchive {
+    size_t streamSize = 0;
+    std::vector<ArchiveEntry> entries;
+};
 
-            lastPos[key] = bufPos;
+static StreamHeader archiveHeader(const uint8_t* data, size_t size) {
+    if (size < STREAM_HEADER_SIZE)
+        throw std::runtime_error("Not a ZeroBit archive");
+    return parseStreamHeader(data);
+}
+
+static void checkSingle(const uint8_t* data, size_t size) {
+    if (archiveHeader(data, size).flags & FLAG_PACKED)
+        throw std::runtime_error("Archive holds several files; unpack it");
+}
+
+static PackedArchive readPacked(const MappedFile& archive) {
+    StreamHeader sh = archiveHeader(archive.data(), archive.size());
+    const uint8_t* data = archive.data();
+    size_t size = archive.size();
+    if (!(sh.flags & FLAG_PACKED))
+        throw std::runtime_error("Not a multi-file archive");
+    if (size < STREAM_HEADER_SIZE + PACK_TRAILER_SIZE
+        || !std::equal(PACK_MAGIC, PACK_MAGIC + sizeof(PACK_MAGIC), data + size - sizeof(PACK_MAGIC)))
+        throw std::runtime_error("Archive has no directory");
+    uint32_t crc;
+    uint64_t dirPos;
+    std::memcpy(&crc, data + size - PACK_TRAILER_SIZE, sizeof(crc));
+    std::memcpy(&dirPos, data + size - PACK_TRAILER_SIZE + sizeof(crc), sizeof(dirPos));
+    if (dirPos < STREAM_HEADER_SIZE || dirPos > size - PACK_TRAILER_SIZE)
+        throw std::runtime_error("Corrupt directory");
+    size_t dirSize = size - PACK_TRAILER_SIZE - size_t(dirPos);
+    if (crc32c(data + dirPos, dirSize) != crc)
+        throw std::runtime_error("Checksum mismatch");
+    PackedArchive pa;
+    pa.streamSize = size_t(dirPos);
+    std::vector<IndexEntry> index = readIndex(data, pa.streamSize);
+    pa.entries = decodeDirectory(data + dirPos, dirSize, index.back().rawOffset);
+    return pa;
+}
+
+// Decodes a multi-file archive in order, calling open(i) as each file
+// starts, empty ones included, and write(data, n) with its bytes. Every
+// file is checked against its directory crc as it ends.
+template <typename Open, typename Write>
+static void decompressPacked(const MappedFile& archive, const PackedArchive& pa, Open&& open, Write&& write,
+    const CompressorOptions& opts) {
+    const auto& entries = pa.entries;
+    size_t cur = 0;
+    bool opened = false;
+    uint64_t left = 0;
+    uint32_t crc = 0;
+    // Moves on to the first file with bytes left, checking the ones that
+    // are complete; atEnd requires every file to be complete instead.
+    auto advance = [&](bool atEnd) {
+        for (;;) {
+            if (!opened) {
+                if (cur == entries.size()) {
+                    if (atEnd) return;
+                    throw std::runtime_error("Corrupt directory");
+                }
+                open(cur);
+                opened = true;
+                left = entries[cur].size;
+                crc = 0;
+            }
+            if (left) {
+                if (atEnd) throw std::runtime_error("Corrupt directory");
+                return;
+            }
+            if (crc != entries[cur].crc)
+                throw std::runtime_error("Checksum mismatch");
+            opened = false;
+            ++cur;
         }
+    };
+    decompressArchive(archive.data(), pa.streamSize,
+        [&](const void* data, size_t n) {
+            auto p = static_cast<const uint8_t*>(data);
+            while (n) {
+                advance(false);
+                size_t take = size_t(std::min<uint64_t>(n, left));
+                crc = crc32c(p, take, crc);
+                write(p, take);
+                p += take;
+                n -= take;
+                left -= take;
+            }
+        },
+        opts);
+    advance(true);
+}
+
+void Compressor::decompress(const std::string& inPath, const std::string& outPath, const CompressorOptions& opts) {
+    namespace fs = std::filesystem;
+    if (!fs::exists(inPath))
+        throw std::runtime_error("Input missing");
+    MappedFile archive(inPath);
+    checkSingle(archive.data(), archive.size());
+    FileSink out(outPath);
+    decompressArchive(archive.data(), archive.size(), [&](const void* data, size_t n) { out.write(data, n); }, opts);
+    out.close();
+}
+
+void Compressor::decompress(std::istream& in, std::ostream& out, const CompressorOptions& opts) {
+    decompressStream(in,
+        [&](const void* data, size_t n) { out.write(static_cast<const char*>(data), std::streamsize(n)); },
+        opts);
+    if (!out.flush()) throw std::runtime_error("Write failed");
+}
+
+uint64_t Compressor::verify(const std::string& inPath, const CompressorOptions& opts) {
+    namespace fs = std::filesystem;
+    if (!fs::exists(inPath))
+        throw std::runtime_error("Input missing");
+    MappedFile archive(inPath);
+    uint64_t total = 0;
+    auto count = [&](const void*, size_t n) { total += n; };
+    if (archiveHeader(archive.data(), archive.size()).flags & FLAG_PACKED)
+        decompressPacked(archive, readPacked(archive), [](size_t) {}, count, opts);
+    else
+        decompressArchive(archive.data(), archive.size(), count, opts);
+    return total;
+}
+
+uint64_t Compressor::verify(std::istream& in, const CompressorOptions& opts) {
+    uint64_t total = 0;
+    decompressStream(in, [&](const void*, size_t n) { total += n; }, opts);
+    return total;
+}
+
+// Appends to a caller's buffer, throwing once it is full.
+class BufferSink {
+    uint8_t* out;
+    size_t capacity;
+    size_t used = 0;
+public:
+    BufferSink(void* dst, size_t cap) : out(static_cast<uint8_t*>(dst)), capacity(cap) {}
+
+    size_t size() const { return used; }
 
-        bufPos = (bufPos + 1) % WINDOW_SIZE;
+    void write(const void* data, size_t n) {
+        if (n > capacity - used) throw Compressor::OutputTooSmall();
+        if (n) std::memcpy(out + used, data, n);
+        used += n;
     }
 };
 
-class LZPModel : public IModel {
-    static constexpr size_t N = 1 << 20;
-    std::vector<uint8_t> buf;
-    std::vector<size_t>  nxt;
+size_t Compressor::compressBuffer(const void* src, size_t n, void* dst, size_t capacity, const CompressorOptions& opts) {
+    checkOptions(opts);
+    const uint8_t* in = static_cast<const uint8_t*>(src);
+    BufferSink out(dst, capacity);
     size_t pos = 0;
-    uint8_t prev = 0;
+    compressBlocks(
+        [&] {
+            ByteView v;
+            v.data = in + pos;
+            v.size = std::min(opts.blockSize, n - pos);
+            pos += v.size;
+            return v;
+        },
+        [&](const void* data, size_t k) { out.write(data, k); },
+        n, opts);
+    return out.size();
+}
 
-public:
-    LZPModel()
-        : buf(N),
-        nxt(N, std::string::npos)
-    {
-    }
+size_t Compressor::decompressBuffer(const void* src, size_t n, void* dst, size_t capacity, const CompressorOptions& opts) {
+    const uint8_t* data = static_cast<const uint8_t*>(src);
+    checkSingle(data, n);
+    BufferSink out(dst, capacity);
+    decompressArchive(data, n, [&](const void* bytes, size_t k) { out.write(bytes, k); }, opts);
+    return out.size();
+}
 
-    uint16_t predict() const override {
-        size_t p = nxt[pos];
-        if (p == std::string::npos) return 32768;
-        uint8_t nb = buf[(p + 1) % N];
-        return (nb & 0x80) ? 49152 : 16384;
+uint64_t Compressor::decompressedSize(const void* src, size_t n) {
+    const uint8_t* data = static_cast<const uint8_t*>(src);
+    checkSingle(data, n);
+    StreamHeader sh = parseStreamHeader(data);
+    return sh.fullSize != UNKNOWN_SIZE ? sh.fullSize : readIndex(data, n).back().rawOffset;
+}
+
+struct CompressStream::State {
+    CompressorOptions opts;
+    stats::Sink statsSink;
+    StreamHeader sh;
+    BlockEncoder encode;
+    RecordLog log;
+    Progress progress;
+    std::vector<uint8_t> input;
+    // Coded bytes not yet handed out.
+    std::vector<uint8_t> output;
+    size_t outputPos = 0;
+    bool ended = false;
+
+    explicit State(const CompressorOptions& o)
+        : opts(o), statsSink(opts.stats), sh(streamHeaderFor(opts, UNKNOWN_SIZE, 0, opts.seekable)),
+        encode(sequentialEncoder(sh, opts, opts.stats ? &statsSink : nullptr)), progress(opts, UNKNOWN_SIZE) {
+        writeStreamHeader(sh, [this](const void* data, size_t n) { append(data, n); });
     }
 
-    void updateBit(int) override {
+    void append(const void* data, size_t n) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        output.insert(output.end(), p, p + n);
     }
 
-    void updateByte(uint8_t b) override {
-        buf[pos] = b;
-        size_t key = (size_t(prev) << 8) | b;
-        nxt[pos] = nxt[key % N];
-        nxt[key % N] = pos;
-        prev = b;
-        pos = (pos + 1) % N;
+    void codeInput() {
+        std::vector<uint8_t> record = encode(input.data(), input.size());
+        input.clear();
+        uint64_t blockLen = log.add(record);
+        append(record.data(), record.size());
+        progress.add(blockLen);
     }
 };
 
-class Mixer {
-    std::vector<IModel*> mods;
-    std::vector<double> w;
-    double lr;
+CompressStream::CompressStream(const CompressorOptions& opts) {
+    checkOptions(opts);
+    state = std::make_unique<State>(opts);
+}
+
+CompressStream::~CompressStream() = default;
+
+size_t CompressStream::compress(StreamOutput& out, StreamInput& in, Directive directive) {
+    State& s = *state;
+    if (s.ended && in.pos < in.size)
+        throw std::runtime_error("Stream already ended");
+    for (;;) {
+        size_t n = std::min(s.output.size() - s.outputPos, out.size - out.pos);
+        if (n) std::memcpy(static_cast<uint8_t*>(out.data) + out.pos, s.output.data() + s.outputPos, n);
+        out.pos += n;
+        s.outputPos += n;
+        if (s.outputPos < s.output.size()) return s.output.size() - s.outputPos;
+        s.output.clear();
+        s.outputPos = 0;
+
+        if (in.pos < in.size) {
+            size_t take = std::min(in.size - in.pos, s.opts.blockSize - s.input.size());
+            const uint8_t* p = static_cast<const uint8_t*>(in.data) + in.pos;
+            s.input.insert(s.input.end(), p, p + take);
+            in.pos += take;
+            if (s.input.size() == s.opts.blockSize) s.codeInput();
+            continue;
+        }
+        if (directive == Directive::Continue) return 0;
+        if (!s.input.empty()) {
+            s.codeInput();
+            continue;
+        }
+        if (directive == Directive::End && !s.ended) {
+            s.log.finish([&](const void* data, size_t k) { s.append(data, k); });
+            s.ended = true;
+            continue;
+        }
+        return 0;
+    }
+}
+
+// Reader over the input a DecompressStream holds. Running past its end
+// throws NeedInput, and the step is tried again once more has arrived.
+class BufferedReader {
+    const uint8_t* start;
+    const uint8_t* p;
+    const uint8_t* end;
 public:
-    Mixer(const std::vector<IModel*>& M, double learningRate = 0.005)
-        : mods(M), w(M.size(), 1.0), lr(learningRate) {
-        if (w.empty()) w.back() = 2.0;
+    struct NeedInput {};
+
+    BufferedReader(const uint8_t* data, size_t size) : start(data), p(data), end(data + size) {}
+
+    size_t consumed() const { return size_t(p - start); }
+
+    const uint8_t* take(size_t n) {
+        if (size_t(end - p) < n) throw NeedInput();
+        const uint8_t* r = p;
+        p += n;
+        return r;
     }
 
-    uint16_t mix() const {
-        double sum = 0.0;
-        for (size_t i = 0; i < mods.size(); ++i) {
-            double pi = std::clamp(mods[i]->predict() / 65535.0, 0.0001, 0.9999);
-            sum += w[i] * std::log(pi / (1.0 - pi));
-        }
-        double p = 1.0 / (1.0 + std::exp(-sum));
-        return static_cast<uint16_t>(p * 65535.0 + 0.5);
+    void read(void* dst, size_t n) {
+        if (n) std::memcpy(dst, take(n), n);
     }
 
-    void update(uint16_t p1, int bit) {
-        double p = std::clamp(p1 / 65535.0, 0.0001, 0.9999);
-        double error = bit - p;
-        for (size_t i = 0; i < mods.size(); ++i) {
-            double pi = std::clamp(mods[i]->predict() / 65535.0, 0.0001, 0.9999);
-            double grad = std::log(pi / (1.0 - pi));
-            w[i] += lr * error * grad;
-        }
+    template <typename T>
+    T get() {
+        T v;
+        read(&v, sizeof(v));
+        return v;
     }
+
+    uint64_t varint() { return decodeVarint([this] { return get<uint8_t>(); }); }
 };
 
-class RangeCoder {
-    uint32_t low = 0, high = 0xFFFFFFFF, follow = 0;
-    std::ostream& os;
-public:
-    explicit RangeCoder(std::ostream& o) : os(o) {}
-    void encode(int bit, uint16_t p1) {
-        uint32_t range = high - low + 1;
-        uint32_t bound = low + (uint64_t(range) * (0xFFFF - p1) >> 16);
-        if (bit) low = bound + 1; else high = bound;
-        for (;;) {
-            if ((high & 0xFF000000) == (low & 0xFF000000)) {
-                os.put(static_cast<char>(high >> 24));
-                for (; follow; --follow) os.put(static_cast<char>(~(high >> 24)));
-                low <<= 8; high = (high << 8) | 0xFF;
+struct DecompressStream::State {
+    enum class Phase { Header, Blocks, Index, Done };
+
+    CompressorOptions opts;
+    stats::Sink statsSink;
+    Phase phase = Phase::Header;
+    StreamHeader sh;
+    BlockDecoder decode;
+    std::unique_ptr<Progress> progress;
+    StreamChecksum sum;
+    std::vector<IndexEntry> seen{ { 0, STREAM_HEADER_SIZE } };
+    // Input not yet used starts at inputPos.
+    std::vector<uint8_t> input;
+    size_t inputPos = 0;
+    std::string output;
+    size_t outputPos = 0;
+
+    explicit State(const CompressorOptions& o) : opts(o), statsSink(opts.stats) {}
+
+    // Reads the stream header, one block or the index from the input held;
+    // returns false when that needs more input.
+    bool step() {
+        BufferedReader r(input.data() + inputPos, input.size() - inputPos);
+        uint64_t decoded = 0;
+        try {
+            switch (phase) {
+            case Phase::Header:
+                sh = parseStreamHeader(r.take(STREAM_HEADER_SIZE));
+                if (sh.flags & FLAG_PACKED)
+                    throw std::runtime_error("Archive holds several files; unpack it from a file");
+                checkDictionary(sh, opts);
+                decode = sequentialDecoder(sh, opts, opts.stats ? &statsSink : nullptr);
+                progress = std::make_unique<Progress>(opts, sh.fullSize);
+                phase = Phase::Blocks;
+                break;
+            case Phase::Blocks: {
+                BlockHeader h;
+                if (!readBlockHeader(r, h)) {
+                    if (h.crc != sum.value())
+                        throw std::runtime_error("Checksum mismatch");
+                    phase = Phase::Index;
+                    break;
+                }
+                const uint8_t* payload = r.take(size_t(h.compSize));
+                output = decode(h, payload);
+                outputPos = 0;
+                sum.add(h.blockLen, h.crc);
+                seen.push_back({ seen.back().rawOffset + h.blockLen, seen.back().archiveOffset + r.consumed() });
+                decoded = h.blockLen;
+                break;
             }
-            else if ((low & 0x80000000) && !(high & 0x80000000)) {
-                ++follow;
-                low = (low << 1) & 0x7FFFFFFF;
-                high = ((high ^ 0x80000000) << 1) | 1;
+            case Phase::Index:
+                readStreamIndex(r, seen);
+                phase = Phase::Done;
+                break;
+            case Phase::Done:
+                break;
             }
-            else break;
         }
-    }
-    void finish() {
-        for (int i = 0; i < 4; ++i) {
-            os.put(static_cast<char>(low >> 24));
-            low <<= 8;
+        catch (const BufferedReader::NeedInput&) {
+            return false;
         }
+        inputPos += r.consumed();
+        if (phase == Phase::Done && inputPos < input.size())
+            throw std::runtime_error("Data after the end of the archive");
+        if (decoded) progress->add(decoded);
+        return true;
     }
 };
 
-class RangeDecoder {
-    uint32_t low = 0, high = 0xFFFFFFFF, code = 0;
-    std::istream& is;
-public:
-    explicit RangeDecoder(std::istream& i) : is(i) {
-        for (int k = 0; k < 4; ++k) code = (code << 8) | static_cast<uint8_t>(is.get());
-    }
-    int decode(uint16_t p1) {
-        uint32_t range = high - low + 1;
-        uint32_t bound = low + (uint64_t(range) * (0xFFFF - p1) >> 16);
-        int bit;
-        if (code <= bound) { bit = 0; high = bound; }
-        else { bit = 1; low = bound + 1; }
-        for (;;) {
-            if ((high & 0xFF000000) == (low & 0xFF000000)) {
-                low <<= 8; high = (high << 8) | 0xFF;
-                code = (code << 8) | static_cast<uint8_t>(is.get());
-            }
-            else if ((low & 0x80000000) && !(high & 0x80000000)) {
-                low = (low << 1) & 0x7FFFFFFF;
-                high = ((high ^ 0x80000000) << 1) | 1;
-                code = ((code ^ 0x80000000) << 1) | (static_cast<uint8_t>(is.get()) & 1);
-            }
-            else break;
-        }
-        return bit;
+DecompressStream::DecompressStream(const CompressorOptions& opts)
+    : state(std::make_unique<State>(opts)) {
+}
+
+DecompressStream::~DecompressStream() = default;
+
+size_t DecompressStream::decompress(StreamOutput& out, StreamInput& in) {
+    State& s = *state;
+    if (in.pos < in.size) {
+        if (s.phase == State::Phase::Done)
+            throw std::runtime_error("Data after the end of the archive");
+        s.input.erase(s.input.begin(), s.input.begin() + std::ptrdiff_t(s.inputPos));
+        s.inputPos = 0;
+        const uint8_t* p = static_cast<const uint8_t*>(in.data) + in.pos;
+        s.input.insert(s.input.end(), p, p + (in.size - in.pos));
+        in.pos = in.size;
     }
-};
+    for (;;) {
+        size_t n = std::min(s.output.size() - s.outputPos, out.size - out.pos);
+        if (n) std::memcpy(static_cast<uint8_t*>(out.data) + out.pos, s.output.data() + s.outputPos, n);
+        out.pos += n;
+        s.outputPos += n;
+        if (s.outputPos < s.output.size()) return s.output.size() - s.outputPos;
+        s.output.clear();
+        s.outputPos = 0;
+        if (s.phase == State::Phase::Done) return 0;
+        if (!s.step()) return 1;
+    }
+}
 
-static bool exists(const std::string& p) { return fs::exists(p); }
+static std::string readStreamRange(const uint8_t* data, size_t size, uint64_t offset, size_t length,
+    const CompressorOptions& opts) {
+    ArchiveReader in(data, size);
+    StreamHeader sh = parseStreamHeader(in.take(STREAM_HEADER_SIZE));
+    std::vector<IndexEntry> index = readIndex(data, size);
+    if (sh.fullSize != UNKNOWN_SIZE && sh.fullSize != index.back().rawOffset)
+        throw std::runtime_error("Corrupt index");
+    uint64_t end = std::min(offset + std::min<uint64_t>(length, ~uint64_t(0) - offset), index.back().rawOffset);
+    if (offset >= end) return std::string();
+    auto byRaw = [](uint64_t v, const IndexEntry& e) { return v < e.rawOffset; };
+    // Blocks first..last-1 overlap the range. Shared models have to be
+    // replayed from the first block of the archive.
+    size_t first = size_t(std::upper_bound(index.begin(), index.end() - 1, offset, byRaw) - index.begin()) - 1;
+    size_t last = size_t(std::upper_bound(index.begin(), index.end() - 1, end - 1, byRaw) - index.begin());
+    if (!(sh.flags & FLAG_INDEPENDENT_BLOCKS)) first = 0;
 
-void Compressor::compress(const std::string& inPath, const std::string& outPath) {
+    std::string out;
+    out.reserve(size_t(end - offset));
+    size_t i = first;
+    uint64_t pos = index[first].rawOffset;
+    decompressBlocks(sh,
+        [&](BlockHeader& h) {
+            ByteView v;
+            if (i == last) return v;
+            const IndexEntry& e = index[i];
+            ArchiveReader r(data + e.archiveOffset, size_t(index.back().archiveOffset - e.archiveOffset));
+            v.data = readBlock(r, h);
+            if (!v.data || h.blockLen != index[i + 1].rawOffset - e.rawOffset)
+                throw std::runtime_error("Corrupt index");
+            v.size = size_t(h.compSize);
+            ++i;
+            return v;
+        },
+        [&](const void* bytes, size_t n) {
+            uint64_t lo = std::max(pos, offset), hi = std::min(pos + n, end);
+            if (lo < hi) out.append(static_cast<const char*>(bytes) + (lo - pos), size_t(hi - lo));
+            pos += n;
+        },
+        opts, last - first);
+    return out;
+}
+
+std::string Compressor::readRange(const std::string& inPath, uint64_t offset, size_t length, const CompressorOptions& opts) {
     namespace fs = std::filesystem;
-    if (fs::exists(outPath))
-        throw std::runtime_error("Output already exists");
-    std::ifstream fin(inPath, std::ios::binary);
-    if (!fin) throw std::runtime_error("Cannot open input");
-    std::string input((std::istreambuf_iterator<char>(fin)), {});
-    fin.close();
-    std::ofstream out(outPath, std::ios::binary);
-    if (!out) throw std::runtime_error("Cannot open output");
-    uint64_t fullSize = input.size();
-    out.write(reinterpret_cast<const char*>(&fullSize), sizeof(fullSize));
-    ByteContextModel bcm1(1), bcm2(2), bcm3(3), bcm4(4);
-    BitContextModel bitm(24);
-    MatchModel match4(4), match8(8);
-    LZPModel lzp;
-    std::vector<IModel*> mods = { &bcm1, &bcm2, &bcm3, &bcm4, &bitm, &match4, &match8, &lzp };
-    Mixer mixer(mods, 0.001);
-    auto [bwtLast, primary] = bwtTransform(input);
-    auto mtf = mtfEncode(bwtLast);
-    auto rle = rleZero(mtf);
-    std::ostringstream tmp(std::ios::binary);
-    RangeCoder coder(tmp);
-    for (uint8_t byte : rle) {
-        for (int b = 7; b >= 0; --b) {
-            int bit = (byte >> b) & 1;
-            uint16_t p1 = mixer.mix();
-            coder.encode(bit, p1);
-            mixer.update(p1, bit);
-            for (IModel* m : mods)
-                m->updateBit(bit);
-        }
-        for (auto* m : mods) m->updateByte(byte);
+    if (!fs::exists(inPath))
+        throw std::runtime_error("Input missing");
+    MappedFile archive(inPath);
+    checkSingle(archive.data(), archive.size());
+    return readStreamRange(archive.data(), archive.size(), offset, length, opts);
+}
+
+std::string Compressor::trainDictionary(const std::vector<std::string>& samplePaths, size_t maxSize) {
+    std::vector<std::unique_ptr<MappedFile>> files;
+    std::vector<std::string_view> samples;
+    for (const auto& path : samplePaths) {
+        files.push_back(std::make_unique<MappedFile>(path));
+        samples.emplace_back(reinterpret_cast<const char*>(files.back()->data()), files.back()->size());
     }
-    coder.finish();
-    std::string compData = tmp.str();
-    uint32_t blockLen = uint32_t(input.size());
-    uint32_t rleCount = uint32_t(rle.size());
-    uint32_t compSize = uint32_t(compData.size());
-    out.write(reinterpret_cast<const char*>(&blockLen), sizeof(blockLen));
-    out.write(reinterpret_cast<const char*>(&primary), sizeof(primary));
-    out.write(reinterpret_cast<const char*>(&rleCount), sizeof(rleCount));
-    out.write(reinterpret_cast<const char*>(&compSize), sizeof(compSize));
-    out.write(compData.data(), compData.size());
-}
-
-void Compressor::decompress(const std::string& inPath, const std::string& outPath) {
+    return buildDictionary(samples, maxSize);
+}
+
+void Compressor::packFiles(const std::vector<std::string>& inputs, const std::string& outPath, const CompressorOptions& opts) {
+    namespace fs = std::filesystem;
+    checkOptions(opts);
+    if (!opts.overwrite && fs::exists(outPath))
+        throw std::runtime_error("Output already exists");
+    PackList list = collectFiles(inputs);
+    FileSink out(outPath);
+    uint64_t written = 0;
+    auto write = [&](const void* data, size_t n) {
+        out.write(data, n);
+        written += n;
+    };
+
+    // Blocks are filled from one file after another, so a block can hold
+    // the end of one file and the start of the next.
+    size_t file = 0;
+    std::unique_ptr<MappedFile> in;
+    size_t pos = 0;
+    uint32_t crc = 0;
+    compressBlocks(
+        [&] {
+            ByteView v;
+            v.owner = std::make_shared<std::vector<uint8_t>>();
+            auto& buf = *v.owner;
+            while (buf.size() < opts.blockSize && file < list.paths.size()) {
+                if (!in) {
+                    in = std::make_unique<MappedFile>(list.paths[file]);
+                    if (in->size() != list.entries[file].size)
+                        throw std::runtime_error("File changed while packing: " + list.paths[file]);
+                    pos = 0;
+                    crc = 0;
+                }
+                size_t take = std::min(opts.blockSize - buf.size(), in->size() - pos);
+                buf.insert(buf.end(), in->data() + pos, in->data() + pos + take);
+                crc = crc32c(in->data() + pos, take, crc);
+                pos += take;
+                if (pos == in->size()) {
+                    list.entries[file++].crc = crc;
+                    in.reset();
+                }
+            }
+            v.data = buf.data();
+            v.size = buf.size();
+            return v;
+        },
+        write, list.totalSize, opts, FLAG_PACKED);
+
+    std::string dir = encodeDirectory(list.entries);
+    uint32_t dirCrc = crc32c(dir.data(), dir.size());
+    uint64_t dirPos = written;
+    out.write(dir.data(), dir.size());
+    out.write(&dirCrc, sizeof(dirCrc));
+    out.write(&dirPos, sizeof(dirPos));
+    out.write(PACK_MAGIC, sizeof(PACK_MAGIC));
+    out.close();
+}
+
+void Compressor::unpackFiles(const std::string& inPath, const std::string& outDir, const CompressorOptions& opts) {
     namespace fs = std::filesystem;
     if (!fs::exists(inPath))
         throw std::runtime_error("Input missing");
-    std::ifstream in(inPath, std::ios::binary);
-    if (!in) throw std::runtime_error("Cannot open input");
-    uint64_t fullSize;
-    in.read(reinterpret_cast<char*>(&fullSize), sizeof(fullSize));
-    ByteContextModel bcm1(1), bcm2(2), bcm3(3), bcm4(4);
-    BitContextModel bitm(24);
-    MatchModel match4(4), match8(8);
-    LZPModel lzp;
-    std::vector<IModel*> mods = { &bcm1, &bcm2, &bcm3, &bcm4, &bitm, &match4, &match8, &lzp };
-    Mixer mixer(mods, 0.001);
-    std::ofstream out(outPath, std::ios::binary);
-    if (!out) throw std::runtime_error("Cannot open output");
-    while (true) {
-        uint32_t blockLen, primary, rleCount, compSize;
-        if (!in.read(reinterpret_cast<char*>(&blockLen), sizeof(blockLen)))
-            break;
-        in.read(reinterpret_cast<char*>(&primary), sizeof(primary));
-        in.read(reinterpret_cast<char*>(&rleCount), sizeof(rleCount));
-        in.read(reinterpret_cast<char*>(&compSize), sizeof(compSize));
-        std::vector<char> buf(compSize);
-        in.read(buf.data(), compSize);
-        std::istringstream tmpIn(std::string(buf.data(), compSize), std::ios::binary);
-        RangeDecoder dec(tmpIn);
-        std::vector<uint8_t> rle;
-        rle.reserve(rleCount);
-        for (uint32_t i = 0; i < rleCount; ++i) {
-            uint8_t c = 0;
-            for (int b = 7; b >= 0; --b) {
-                uint16_t p1 = mixer.mix();
-                int bit = dec.decode(p1);
-                mixer.update(p1, bit);
-                for (IModel* model : mods)
-                    model->updateBit(bit);
-                c |= (uint8_t(bit) << b);
-            }
-            rle.push_back(c);
-            for (IModel* model : mods)
-                model->updateByte(c);
-        }
-        auto mtf = rleZeroDecode(rle);
-        auto bwt = mtfDecode(mtf);
-        auto block = bwtInverse(bwt, primary);
-        out.write(block.data(), blockLen);
-    }
-}
\ No newline at end of file
+    MappedFile archive(inPath);
+    PackedArchive pa = readPacked(archive);
+    fs::create_directories(outDir);
+    std::unique_ptr<FileSink> out;
+    decompressPacked(archive, pa,
+        [&](size_t i) {
+            if (out) out->close();
+            fs::path path = fs::path(outDir) / fs::u8path(pa.entries[i].name);
+            fs::create_directories(path.parent_path());
+            out = std::make_unique<FileSink>(path.string());
+        },
+        [&](const void* data, size_t n) { out->write(data, n); },
+        opts);
+    if (out) out->close();
+}
+
+bool Compressor::isPacked(const std::string& inPath) {
+    MappedFile archive(inPath);
+    return archiveHeader(archive.data(), archive.size()).flags & FLAG_PACKED;
+}
+
+std::vector<ArchiveEntry> Compressor::listFiles(const std::string& inPath) {
+    MappedFile archive(inPath);
+    return readPacked(archive).entries;
+}
+
+std::string Compressor::readFile(const std::string& inPath, const std::string& name, const CompressorOptions& opts) {
+    MappedFile archive(inPath);
+    PackedArchive pa = readPacked(archive);
+    auto e = std::find_if(pa.entries.begin(), pa.entries.end(), [&](const ArchiveEntry& x) { return x.name == name; });
+    if (e == pa.entries.end())
+        throw std::runtime_error("No such file in archive: " + name);
+    std::string bytes = readStreamRange(archive.data(), pa.streamSize, e->offset, size_t(e->size), opts);
+    if (crc32c(bytes.data(), bytes.size()) != e->crc)
+        throw std::runtime_error("Checksum mismatch");
+    return bytes;
+}
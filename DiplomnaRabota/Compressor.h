@@ -2,11 +2,291 @@
 #define COMPRESSOR_H
 
 #include <string>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+// Keeps the models of one call for the next, so a run of small inputs
+// clears them instead of allocating and zeroing tens of megabytes each
+// time. Only pages the last input wrote are cleared, and output is
+// identical to coding without a context. Holds one set of models per
+// thread that codes blocks, for the level and model memory last used, so
+// a call with several threads keeps that many. Calls without a context
+// still reuse each worker's models from block to block. Not thread-safe:
+// use one context per thread.
+class CompressorContext {
+public:
+    CompressorContext();
+    ~CompressorContext();
+    CompressorContext(const CompressorContext&) = delete;
+    CompressorContext& operator=(const CompressorContext&) = delete;
+
+    // Frees the cached models.
+    void release();
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+    friend struct ContextAccess;
+};
+
+// Where the time and the bits went, summed over every block coded with
+// CompressorOptions::stats set. Only libraries built with ZEROBIT_STATS
+// collect anything; the hooks are compiled out otherwise.
+struct CompressorStats {
+    // Time and bytes in and out of one stage. Decompression runs the
+    // stages in reverse, so there each one's input is the next one's output.
+    struct Stage {
+        double seconds = 0;
+        uint64_t bytesIn = 0;
+        uint64_t bytesOut = 0;
+    };
+
+    struct Model {
+        std::string name;
+        // Time in predict and update, sampled on one byte in 64 and scaled
+        // up to the whole run.
+        double seconds = 0;
+        // Bits predicted and what coding them with this model's prediction
+        // alone would have cost, in bits.
+        uint64_t bits = 0;
+        double lossBits = 0;
+        // Context lookups, and how many found history from earlier data.
+        uint64_t lookups = 0;
+        uint64_t hits = 0;
+        // Match models only: bytes coded with a current match of length 0,
+        // 1, 2-3, 4-7 and so on up to 32768-65535.
+        std::vector<uint64_t> matchLengths;
+    };
+
+    // Set once a block has been measured; stays false in a library built
+    // without ZEROBIT_STATS.
+    bool collected = false;
+    uint64_t blocks = 0;
+    Stage filter, bwt, mtf, rle, modelling, coding;
+    std::vector<Model> models;
+    // What the mixed and refined predictions cost, in bits: the coded size.
+    double mixedLossBits = 0;
+    // Mean mixer weight of each model input, then of the bias, after each
+    // block, in the order blocks finished. 1.0 passes an input through as is.
+    std::vector<std::vector<double>> mixerWeights;
+    // Context-table slots, those holding history after the last block, and
+    // how often one had to be evicted to make room.
+    uint64_t tableSlots = 0;
+    uint64_t tableUsed = 0;
+    uint64_t tableEvictions = 0;
+
+    // Whether this build of the library collects statistics.
+    static bool available();
+    std::string toJson() const;
+    // Prometheus text exposition format; metrics are prefixed zerobit_.
+    std::string toPrometheus() const;
+};
+
+struct CompressorOptions {
+    // Bytes of input transformed and coded per block; bounds peak memory.
+    size_t blockSize = 100 * 1024;
+    // Worker threads; 0 picks the hardware concurrency. At most
+    // Compressor::MAX_THREADS, and no more than there are blocks. Compressing
+    // with more than one thread codes every block with its own fresh models.
+    unsigned threads = 1;
+    // 1 (fastest) to 9 (smallest): picks the models, the default model
+    // memory and the pipeline stages. Recorded in the archive.
+    int level = 6;
+    // Budget for the context models' hash table, per block coded at once;
+    // rounded down to a power of two between 64 KiB and 2 GiB. 0 uses the
+    // level's budget, from 1 MiB at level 1 to 256 MiB at level 9.
+    size_t modelMemory = 0;
+    // Move-to-front + zero-run stage between BWT and the coder. When off,
+    // the BWT output goes to the context-mixing coder directly. Levels 8
+    // and 9 decide per block from a trial on part of the BWT output.
+    bool mtf = true;
+    // Per-block detection of delimited tables and repetitive words, which
+    // are transposed, delta-coded or tokenised before the BWT.
+    bool preprocess = true;
+    // Per-block detection of compressed or random data, which is stored as
+    // is, or LZ-coded when it repeats, instead of run through the BWT and
+    // the models. Lower levels take more blocks this way; see LevelParams.
+    bool fastBlocks = true;
+    // Codes every block with fresh models, as more than one thread does, so
+    // readRange only decodes the blocks a range overlaps.
+    bool seekable = false;
+    // Sample data the models are trained on before coding, so small inputs
+    // do not start from empty statistics; see trainDictionary. Archives
+    // record its checksum, and decompressing needs the same bytes.
+    std::string dictionary;
+    // Called on the calling thread after each block with the original
+    // bytes done so far and the total, 0 when unknown. Returning false
+    // cancels: the call throws Compressor::Cancelled once the blocks
+    // already in flight have finished.
+    std::function<bool(uint64_t done, uint64_t total)> progress;
+    // Memory for the suffix array when compressing, and the row table when
+    // decompressing, per block transformed at once: 4 to 8 times the block
+    // size. Larger arrays are memory-mapped from a temporary file instead.
+    // This is plain demand paging, not an external-memory sort: both
+    // passes touch the array at random, so once it outgrows free RAM the
+    // block is paged in and out and runs far slower. The block and its BWT
+    // output stay in memory either way. 0 never uses the disk.
+    size_t bwtMemory = 0;
+    // Lets compress and packFiles replace an existing output file. Files
+    // are written under a temporary name and renamed over the output once
+    // complete, so a failed or cancelled call leaves the old one in place.
+    bool overwrite = false;
+    // Optional models reused across calls; see CompressorContext.
+    CompressorContext* context = nullptr;
+    // Optional statistics, added to across calls; see CompressorStats.
+    CompressorStats* stats = nullptr;
+};
+
+// One file of a multi-file archive.
+struct ArchiveEntry {
+    // Path below the archive root, '/'-separated.
+    std::string name;
+    // Where the file's bytes start in the archive's original data.
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    // CRC-32C of the file's bytes.
+    uint32_t crc = 0;
+};
 
 class Compressor {
 public:
-    static void compress(const std::string& inPath, const std::string& outPath);
-    static void decompress(const std::string& inPath, const std::string& outPath);
+    static constexpr size_t MAX_BLOCK_SIZE = size_t(1) << (sizeof(size_t) > 4 ? 34 : 30);
+    static constexpr int MIN_LEVEL = 1;
+    static constexpr int MAX_LEVEL = 9;
+    static constexpr unsigned MAX_THREADS = 256;
+    static constexpr size_t DEFAULT_DICTIONARY_SIZE = 16 * 1024;
+
+    struct Cancelled : std::runtime_error {
+        Cancelled() : std::runtime_error("Cancelled") {}
+    };
+    // Thrown by the buffer calls when dst cannot hold the result.
+    struct OutputTooSmall : std::runtime_error {
+        OutputTooSmall() : std::runtime_error("Output buffer too small") {}
+    };
+
+    static void compress(const std::string& inPath, const std::string& outPath,
+        const CompressorOptions& opts = CompressorOptions());
+    static void decompress(const std::string& inPath, const std::string& outPath,
+        const CompressorOptions& opts = CompressorOptions());
+
+    // Stream variants read the input block by block, so pipes work and memory
+    // stays bounded. The original size is recorded as unknown.
+    static void compress(std::istream& in, std::ostream& out,
+        const CompressorOptions& opts = CompressorOptions());
+    static void decompress(std::istream& in, std::ostream& out,
+        const CompressorOptions& opts = CompressorOptions());
+
+    // Decodes the archive and checks every block and the stream checksum
+    // without writing anything; returns the original size. Throws on the
+    // first damaged block, like decompress. Multi-file archives also have
+    // each file checked against the directory.
+    static uint64_t verify(const std::string& inPath, const CompressorOptions& opts = CompressorOptions());
+    static uint64_t verify(std::istream& in, const CompressorOptions& opts = CompressorOptions());
+
+    // One-shot coding between memory buffers; returns the bytes written to
+    // dst, or throws OutputTooSmall. In blocks of 64 KiB or more, n bytes
+    // compress into at most n + n / 1024 + 1024 whenever every block
+    // shrinks or is stored, as blocks with fresh models (seekable or
+    // several threads) always do.
+    static size_t compressBuffer(const void* src, size_t n, void* dst, size_t capacity,
+        const CompressorOptions& opts = CompressorOptions());
+    static size_t decompressBuffer(const void* src, size_t n, void* dst, size_t capacity,
+        const CompressorOptions& opts = CompressorOptions());
+    // Original size of the archive in src, read from its header or index.
+    static uint64_t decompressedSize(const void* src, size_t n);
+
+    // Returns up to length bytes of the original data starting at offset,
+    // found through the archive's block index. Archives written with
+    // seekable or several threads decode only the overlapping blocks, in
+    // parallel with opts.threads; others decode from the first block on.
+    static std::string readRange(const std::string& inPath, uint64_t offset, size_t length,
+        const CompressorOptions& opts = CompressorOptions());
+
+    // Builds a dictionary of at most maxSize bytes from sample files that
+    // look like the data it will be used for. Training beyond 16-32 KiB
+    // rarely helps: the models learn statistics, not strings to copy.
+    static std::string trainDictionary(const std::vector<std::string>& samplePaths,
+        size_t maxSize = DEFAULT_DICTIONARY_SIZE);
+
+    // Multi-file archives code many files as one solid stream, so models and
+    // BWT contexts carry over from file to file, followed by a directory.
+    // Inputs are files, stored under their file name, or directories, whose
+    // files are stored under the directory's name. Files are grouped by
+    // extension and leading bytes so similar ones are coded together.
+    static void packFiles(const std::vector<std::string>& inputs, const std::string& outPath,
+        const CompressorOptions& opts = CompressorOptions());
+    // Writes every file below outDir, creating it and any subdirectories.
+    static void unpackFiles(const std::string& inPath, const std::string& outDir,
+        const CompressorOptions& opts = CompressorOptions());
+    static bool isPacked(const std::string& inPath);
+    // Reads the directory only; nothing is decoded.
+    static std::vector<ArchiveEntry> listFiles(const std::string& inPath);
+    // Decodes one file through the block index, like readRange.
+    static std::string readFile(const std::string& inPath, const std::string& name,
+        const CompressorOptions& opts = CompressorOptions());
+};
+
+// Input and output windows for the push/pull stream classes. Each call
+// advances pos past the bytes it consumed or produced.
+struct StreamInput {
+    const void* data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+};
+
+struct StreamOutput {
+    void* data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+};
+
+// Incremental compression in the style of zstd's streaming API: input is
+// taken in pieces of any size and each call writes only what fits in the
+// output window. A block is coded once blockSize bytes have arrived, on
+// the calling thread; opts.threads is not used. Flush codes the bytes
+// given so far as a short block, so a decoder can output them; End also
+// writes the index. The archive is the same as the stream overload of
+// Compressor::compress writes for the same blocks.
+class CompressStream {
+public:
+    enum class Directive { Continue, Flush, End };
+
+    explicit CompressStream(const CompressorOptions& opts = CompressorOptions());
+    ~CompressStream();
+    CompressStream(const CompressStream&) = delete;
+    CompressStream& operator=(const CompressStream&) = delete;
+
+    // Returns the number of coded bytes still held back for lack of room
+    // in out. After Flush or End, call again with room until it returns 0.
+    size_t compress(StreamOutput& out, StreamInput& in, Directive directive = Directive::Continue);
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+// Incremental decompression of single-file archives. All input passed in
+// is taken; output is written as each block is decoded and checked.
+class DecompressStream {
+public:
+    explicit DecompressStream(const CompressorOptions& opts = CompressorOptions());
+    ~DecompressStream();
+    DecompressStream(const DecompressStream&) = delete;
+    DecompressStream& operator=(const DecompressStream&) = delete;
+
+    // Returns 0 once the archive has been read to the end of its index,
+    // checked and written out; otherwise it needs more input or, when out
+    // is full, more room. Throws on damaged input.
+    size_t decompress(StreamOutput& out, StreamInput& in);
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
 };
 
 #endif
\ No newline at end of file
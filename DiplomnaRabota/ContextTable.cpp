@@ -0,0 +1,67 @@
+#include "ContextTable.h"
+#include "StateMap.h"
+#include <cstring>
+
+// Slots 0, 1, 2, 3 from most to least recent.
+static constexpr uint8_t FRESH_ORDER = 0xE4;
+
+// Moves the slot at position pos of a bucket's order to the front.
+static uint8_t promote(uint8_t order, size_t pos) {
+    uint32_t below = order & ((1u << (2 * pos)) - 1);
+    uint32_t above = order & ~((1u << (2 * pos + 2)) - 1);
+    return uint8_t(above | below << 2 | ((order >> (2 * pos)) & 3));
+}
+
+ContextTable::ContextTable(size_t bytes) {
+    size_t n = MIN_BYTES / sizeof(Bucket);
+    while (n * 2 * sizeof(Bucket) <= bytes) n *= 2;
+    buckets.resize(n);
+    order.assign(n, FRESH_ORDER);
+    mask = uint32_t(n - 1);
+    maxTouched = n / 4;
+}
+
+void ContextTable::reset() {
+    if (touched.size() >= maxTouched) {
+        std::memset(buckets.data(), 0, buckets.size() * sizeof(Bucket));
+        std::memset(order.data(), FRESH_ORDER, order.size());
+    }
+    else {
+        for (uint32_t i : touched) {
+            buckets[i] = Bucket();
+            order[i] = FRESH_ORDER;
+        }
+    }
+    touched.clear();
+#ifdef ZEROBIT_STATS
+    used = 0;
+#endif
+}
+
+uint8_t* ContextTable::find(uint32_t hash) {
+    uint32_t index = hash & mask;
+    if (touched.size() < maxTouched) touched.push_back(index);
+    Bucket& b = buckets[index];
+    uint8_t& ord = order[index];
+    uint8_t check = uint8_t(hash >> 24);
+    size_t i = 0;
+    while (i < 4 && b.slots[i][0] != check) ++i;
+    size_t pos = 0;
+    if (i < 4) {
+        while (((ord >> (2 * pos)) & 3) != i) ++pos;
+    }
+    else {
+        uint8_t* third = b.slots[(ord >> 4) & 3];
+        uint8_t* fourth = b.slots[ord >> 6];
+        pos = bithistory::priority(fourth[1]) <= bithistory::priority(third[1]) ? 3 : 2;
+        uint8_t* slot = pos == 3 ? fourth : third;
+#ifdef ZEROBIT_STATS
+        if (slot[1]) ++evictions;
+        else ++used;
+#endif
+        std::memset(slot, 0, 16);
+        slot[0] = check;
+    }
+    ord = promote(ord, pos);
+    return b.slots[ord & 3] + 1;
+}
@@ -0,0 +1,62 @@
+#ifndef CONTEXTTABLE_H
+#define CONTEXTTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+inline uint32_t hashContext(uint32_t a, uint32_t b) {
+    uint32_t h = a * 0x9E3779B1u ^ (b + 0x7F4A7C15u) * 0x85EBCA77u;
+    h ^= h >> 15; h *= 0x2C1B3C6Du;
+    h ^= h >> 13; h *= 0x297A2D39u;
+    return h ^ (h >> 16);
+}
+
+// Fixed-size context hash table shared by the context models. Each 64-byte
+// bucket holds four 16-byte slots: an 8-bit checksum followed by the 15
+// bit-history states of one nibble (a binary tree over four bits). Slots
+// never move once claimed, so models may hold several found in the same
+// byte; a byte per bucket keeps their most-recently-used order, and a miss
+// evicts the less used of the two oldest slots.
+class ContextTable {
+public:
+    static constexpr size_t SLOT_STATES = 15;
+    static constexpr size_t MIN_BYTES = size_t(1) << 16;
+
+    // bytes is rounded down to a power of two, at least MIN_BYTES.
+    explicit ContextTable(size_t bytes);
+
+    // Returns the states of the slot for hash, claiming one on a miss.
+    uint8_t* find(uint32_t hash);
+
+    // Empties the table. After a small input only the buckets it touched
+    // are cleared, which is far cheaper than a new table.
+    void reset();
+
+#ifdef ZEROBIT_STATS
+    uint64_t slots() const { return uint64_t(buckets.size()) * 4; }
+    // Slots holding history since the last reset.
+    uint64_t usedSlots() const { return used; }
+    // Slots evicted since the last call.
+    uint64_t takeEvictions() { uint64_t n = evictions; evictions = 0; return n; }
+#endif
+
+private:
+    struct alignas(64) Bucket {
+        uint8_t slots[4][16];
+    };
+    std::vector<Bucket> buckets;
+    // Slot indices of each bucket, two bits each, most recent in the low bits.
+    std::vector<uint8_t> order;
+    uint32_t mask;
+    // Buckets found since the last reset, repeats included; once a quarter
+    // of the table's worth are listed, reset clears it whole.
+    std::vector<uint32_t> touched;
+    size_t maxTouched;
+#ifdef ZEROBIT_STATS
+    uint64_t used = 0;
+    uint64_t evictions = 0;
+#endif
+};
+
+#endif
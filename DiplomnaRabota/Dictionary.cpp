@@ -0,0 +1,96 @@
+#include "Dictionary.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <utility>
+
+namespace {
+
+constexpr size_t K = 8;
+constexpr size_t SEGMENT = 256;
+constexpr uint32_t HASH_BITS = 22;
+// Segments scored; larger sample sets are thinned evenly, as rescoring
+// dominates the run time and more candidates rarely find better ones.
+constexpr size_t MAX_CANDIDATES = size_t(1) << 15;
+
+uint32_t substringHash(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return uint32_t((v * 0x9E3779B97F4A7C15ull) >> (64 - HASH_BITS));
+}
+
+struct Segment {
+    const char* data;
+    size_t size;
+};
+
+}
+
+std::string buildDictionary(const std::vector<std::string_view>& samples, size_t maxSize) {
+    std::string dict;
+    size_t total = 0;
+    for (auto s : samples) total += s.size();
+    if (total <= maxSize) {
+        for (auto s : samples) dict.append(s);
+        return dict;
+    }
+
+    std::vector<uint32_t> freq(size_t(1) << HASH_BITS, 0);
+    std::vector<Segment> segments;
+    for (auto s : samples) {
+        for (size_t p = 0; p + K <= s.size(); ++p) {
+            uint32_t& f = freq[substringHash(s.data() + p)];
+            if (f < UINT32_MAX) ++f;
+        }
+        for (size_t off = 0; off < s.size(); off += SEGMENT) {
+            size_t n = std::min(SEGMENT, s.size() - off);
+            if (n >= K) segments.push_back({ s.data() + off, n });
+        }
+    }
+
+    if (segments.size() > MAX_CANDIDATES) {
+        size_t stride = segments.size() / MAX_CANDIDATES + 1;
+        size_t kept = 0;
+        for (size_t i = 0; i < segments.size(); i += stride) segments[kept++] = segments[i];
+        segments.resize(kept);
+    }
+
+    // A segment is worth the counts of the distinct substrings it holds
+    // that are not covered yet; one seen only once never recurs.
+    std::vector<uint32_t> hashes;
+    auto score = [&](const Segment& g) {
+        hashes.clear();
+        for (size_t j = 0; j + K <= g.size; ++j) hashes.push_back(substringHash(g.data + j));
+        std::sort(hashes.begin(), hashes.end());
+        hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+        uint64_t s = 0;
+        for (uint32_t h : hashes)
+            if (freq[h] > 1) s += freq[h];
+        return s;
+    };
+
+    // Scores only fall as substrings get covered, so a stale score is an
+    // upper bound: rescore the top and take it if it still leads.
+    std::priority_queue<std::pair<uint64_t, size_t>> heap;
+    for (size_t i = 0; i < segments.size(); ++i) heap.push({ score(segments[i]), i });
+    std::vector<std::pair<size_t, size_t>> picked;
+    size_t used = 0;
+    while (!heap.empty() && used < maxSize) {
+        size_t i = heap.top().second;
+        heap.pop();
+        uint64_t s = score(segments[i]);
+        if (s == 0) continue;
+        if (!heap.empty() && s < heap.top().first) {
+            heap.push({ s, i });
+            continue;
+        }
+        for (uint32_t h : hashes) freq[h] = 0;
+        size_t n = std::min(segments[i].size, maxSize - used);
+        picked.push_back({ i, n });
+        used += n;
+    }
+    for (auto it = picked.rbegin(); it != picked.rend(); ++it)
+        dict.append(segments[it->first].data, it->second);
+    return dict;
+}
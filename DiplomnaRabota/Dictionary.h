@@ -0,0 +1,16 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Builds a dictionary of at most maxSize bytes from sample data: segments
+// whose 8-byte substrings recur most often across the samples, picked
+// greedily so each adds substrings not yet covered. The most useful
+// segment comes last, nearest the data the models are primed for. Samples
+// that fit in maxSize together are used whole.
+std::string buildDictionary(const std::vector<std::string_view>& samples, size_t maxSize);
+
+#endif
@@ -6,13 +6,24 @@
 #include <QPushButton>
 #include <QLineEdit>
 #include <QLabel>
+#include <QCheckBox>
 #include <QProgressBar>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
+#include <QDir>
+#include <QFile>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QMessageBox>
 #include <QWidget>
 
+#include <string>
+#include <vector>
+
+// Progress bar resolution; QProgressBar only takes ints, and per-mille
+// steps keep the bar moving smoothly on large batches.
+static constexpr int PROGRESS_STEPS = 1000;
+
 FileCompressorGUI::FileCompressorGUI(QWidget* parent)
     : QMainWindow(parent) {
     setupUI();
@@ -26,13 +37,26 @@ void FileCompressorGUI::setupUI() {
     addFileBtn = new QPushButton("Add File(s)", this);
     removeFileBtn = new QPushButton("Remove Selected", this);
     browseBtn = new QPushButton("Browse...", this);
+    dictionaryBtn = new QPushButton("Browse...", this);
 
     startBtn = new QPushButton("Compress / Decompress", this);
     startBtn->setFixedHeight(40);
+    cancelBtn = new QPushButton("Cancel", this);
+    cancelBtn->setFixedHeight(40);
+    cancelBtn->setEnabled(false);
+    packCheck = new QCheckBox("Pack into one archive", this);
+    packCheck->setToolTip("Compress the files together as one solid archive; "
+        "many small, similar files compress much better this way.");
+    jobQueue = new JobQueue(this);
 
     outputPathEdit = new QLineEdit(this);
     outputPathEdit->setReadOnly(true);
+    dictionaryEdit = new QLineEdit(this);
+    dictionaryEdit->setPlaceholderText("None");
+    dictionaryEdit->setToolTip("Dictionary built with zerobit --train. Archives made with one "
+        "need the same dictionary to decompress.");
     progressBar = new QProgressBar(this);
+    progressBar->setRange(0, PROGRESS_STEPS);
     statusLabel = new QLabel("Status: Idle", this);
 
     auto* fileBtns = new QHBoxLayout;
@@ -43,13 +67,24 @@ void FileCompressorGUI::setupUI() {
     outputDirLayout->addWidget(outputPathEdit);
     outputDirLayout->addWidget(browseBtn);
 
+    auto* dictionaryLayout = new QHBoxLayout;
+    dictionaryLayout->addWidget(dictionaryEdit);
+    dictionaryLayout->addWidget(dictionaryBtn);
+
+    auto* runBtns = new QHBoxLayout;
+    runBtns->addWidget(startBtn);
+    runBtns->addWidget(cancelBtn);
+
     auto* mainLayout = new QVBoxLayout;
     mainLayout->addWidget(new QLabel("Selected File(s):"));
     mainLayout->addWidget(dragAndDropList);
     mainLayout->addLayout(fileBtns);
     mainLayout->addWidget(new QLabel("Output Directory:"));
     mainLayout->addLayout(outputDirLayout);
-    mainLayout->addWidget(startBtn);
+    mainLayout->addWidget(new QLabel("Dictionary (optional):"));
+    mainLayout->addLayout(dictionaryLayout);
+    mainLayout->addWidget(packCheck);
+    mainLayout->addLayout(runBtns);
     mainLayout->addWidget(progressBar);
     mainLayout->addWidget(statusLabel);
 
@@ -61,7 +96,12 @@ void FileCompressorGUI::setupUI() {
     connect(addFileBtn, &QPushButton::clicked, this, &FileCompressorGUI::addFiles);
     connect(removeFileBtn, &QPushButton::clicked, this, &FileCompressorGUI::removeSelectedFiles);
     connect(browseBtn, &QPushButton::clicked, this, &FileCompressorGUI::chooseOutputDirectory);
+    connect(dictionaryBtn, &QPushButton::clicked, this, &FileCompressorGUI::chooseDictionary);
     connect(startBtn, &QPushButton::clicked, this, &FileCompressorGUI::startCompression);
+    connect(cancelBtn, &QPushButton::clicked, this, &FileCompressorGUI::cancelCompression);
+    connect(jobQueue, &JobQueue::progress, this, &FileCompressorGUI::showProgress);
+    connect(jobQueue, &JobQueue::jobFailed, this, &FileCompressorGUI::jobFailed);
+    connect(jobQueue, &JobQueue::finished, this, &FileCompressorGUI::jobsFinished);
 }
 
 void FileCompressorGUI::addFiles() {
@@ -80,7 +120,15 @@ void FileCompressorGUI::chooseOutputDirectory() {
     }
 }
 
+void FileCompressorGUI::chooseDictionary() {
+    QString file = QFileDialog::getOpenFileName(this, "Select Dictionary");
+    if (!file.isEmpty()) {
+        dictionaryEdit->setText(file);
+    }
+}
+
 void FileCompressorGUI::startCompression() {
+    if (jobQueue->isRunning()) return;
     if (dragAndDropList->count() == 0 || outputPathEdit->text().isEmpty()) {
         QMessageBox::warning(this, "Input Error", "Please select files and output directory.");
         return;
@@ -93,44 +141,105 @@ void FileCompressorGUI::startCompression() {
         return;
     }
 
-    statusLabel->setText("Status: Compressiong...");
+    std::string dictionary;
+    if (!dictionaryEdit->text().isEmpty()) {
+        QFile file(dictionaryEdit->text());
+        if (!file.open(QIODevice::ReadOnly)) {
+            QMessageBox::warning(this, "Dictionary Error", "Cannot read the dictionary.");
+            return;
+        }
+        QByteArray bytes = file.readAll();
+        dictionary.assign(bytes.constData(), size_t(bytes.size()));
+    }
+
+    std::vector<JobQueue::Job> jobs;
+    JobQueue::Job packJob;
+    for (int i = 0; i < dragAndDropList->count(); ++i) {
+        QString inputFilePath = dragAndDropList->item(i)->text();
+        QFileInfo inputInfo(inputFilePath);
+        JobQueue::Job job;
+        job.input = inputFilePath;
+
+        if (inputInfo.suffix().toLower() == "srr") {
+            QString originalName = inputInfo.fileName();
+            originalName.chop(4);
+            job.output = dir.filePath(originalName);
+            job.decompress = true;
+        }
+        else {
+            if (packCheck->isChecked()) {
+                packJob.pack << inputFilePath;
+                continue;
+            }
+            job.output = dir.filePath(inputInfo.fileName() + ".srr");
+        }
+        jobs.push_back(job);
+    }
+    if (!packJob.pack.isEmpty()) {
+        packJob.output = QFileDialog::getSaveFileName(this, "Save Archive", dir.filePath("archive.srr"),
+            "ZeroBit archives (*.srr)");
+        if (packJob.output.isEmpty()) return;
+        // The save dialog has confirmed replacing an existing archive; it
+        // is only replaced once the new one is complete.
+        packJob.replace = true;
+        jobs.push_back(packJob);
+    }
+    if (jobs.empty()) return;
+
+    failures.clear();
     progressBar->setValue(0);
-    int fileCount = dragAndDropList->count();
+    statusLabel->setText("Status: Working...");
+    setRunning(true);
+    jobQueue->setDictionary(dictionary);
+    jobQueue->start(jobs);
+}
 
-    QStringList allowedTextExtensions = { "txt", "csv", "log", "xml", "html", "json", "md", "ini", "yaml", "yml" };
+void FileCompressorGUI::cancelCompression() {
+    jobQueue->cancel();
+    cancelBtn->setEnabled(false);
+    statusLabel->setText("Status: Cancelling...");
+}
 
-    for (int i = 0; i < fileCount; ++i) {
-        QListWidgetItem* item = dragAndDropList->item(i);
-        QString inputFilePath = item->text();
-        QFileInfo inputInfo(inputFilePath);
+static QString formatSeconds(double seconds) {
+    qint64 s = qint64(seconds + 0.5);
+    return QString("%1:%2").arg(s / 60).arg(s % 60, 2, 10, QChar('0'));
+}
 
-        try {
-            QString outputFilePath;
+void FileCompressorGUI::showProgress(quint64 done, quint64 total, double bytesPerSecond) {
+    progressBar->setValue(total ? int(double(done) / double(total) * PROGRESS_STEPS) : 0);
+    if (!cancelBtn->isEnabled()) return;
+    QString eta = bytesPerSecond > 0 ? formatSeconds(double(total - done) / bytesPerSecond) : QString("--:--");
+    statusLabel->setText(QString("Status: %1 / %2 MB, %3 MB/s, ETA %4")
+        .arg(double(done) / 1e6, 0, 'f', 1)
+        .arg(double(total) / 1e6, 0, 'f', 1)
+        .arg(bytesPerSecond / 1e6, 0, 'f', 1)
+        .arg(eta));
+}
 
-            if (inputInfo.suffix().toLower() == "srr") {
-                QString originalName = inputInfo.fileName();
-                originalName.chop(4);  
-                outputFilePath = dir.filePath(originalName);
-                Compressor::decompress(inputFilePath.toStdString(), outputFilePath.toStdString());
-            }
-            else {
-                QString ext = inputInfo.suffix().toLower();
-                if (!allowedTextExtensions.contains(ext)) {
-                    QMessageBox::warning(this, "Unsupported File", QString("Skipping unsupported file: %1").arg(inputFilePath));
-                    continue;
-                }
-
-                outputFilePath = dir.filePath(inputInfo.fileName() + ".srr");  
-                Compressor::compress(inputFilePath.toStdString(), outputFilePath.toStdString());
-            }
-        }
-        catch (const std::exception& e) {
-            QMessageBox::critical(this, "Compression Error", QString("Failed to process %1: %2")
-                .arg(inputFilePath, e.what()));
-            statusLabel->setText("Status: Failed!");
-            return;
-        }
+void FileCompressorGUI::jobFailed(const QString& input, const QString& error) {
+    failures << QString("Failed to process %1: %2").arg(input, error);
+}
 
-        progressBar->setValue((i + 1) * 100 / fileCount);
+void FileCompressorGUI::jobsFinished(bool cancelled) {
+    setRunning(false);
+    if (!failures.isEmpty()) {
+        statusLabel->setText("Status: Failed!");
+        QMessageBox::critical(this, "Compression Error", failures.join("\n"));
     }
-}
\ No newline at end of file
+    else {
+        if (!cancelled) progressBar->setValue(PROGRESS_STEPS);
+        statusLabel->setText(cancelled ? "Status: Cancelled" : "Status: Done");
+    }
+}
+
+void FileCompressorGUI::setRunning(bool running) {
+    startBtn->setEnabled(!running);
+    cancelBtn->setEnabled(running);
+    addFileBtn->setEnabled(!running);
+    removeFileBtn->setEnabled(!running);
+    browseBtn->setEnabled(!running);
+    dictionaryBtn->setEnabled(!running);
+    dictionaryEdit->setEnabled(!running);
+    dragAndDropList->setEnabled(!running);
+    packCheck->setEnabled(!running);
+}
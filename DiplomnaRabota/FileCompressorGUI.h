@@ -3,14 +3,17 @@
 #define FILECOMPRESSORGUI_H
 
 #include "DragAndDropList.h"
+#include "JobQueue.h"
 
 #include <QMainWindow>
+#include <QStringList>
 
 class QListWidget;
 class QLineEdit;
 class QPushButton;
 class QProgressBar;
 class QLabel;
+class QCheckBox;
 
 class FileCompressorGUI : public QMainWindow {
     Q_OBJECT
@@ -22,19 +25,31 @@ private slots:
     void addFiles();
     void removeSelectedFiles();
     void chooseOutputDirectory();
+    void chooseDictionary();
     void startCompression();
+    void cancelCompression();
+    void showProgress(quint64 done, quint64 total, double bytesPerSecond);
+    void jobFailed(const QString& input, const QString& error);
+    void jobsFinished(bool cancelled);
 
 private:
     DragAndDropList* dragAndDropList;
     QLineEdit* outputPathEdit;
+    QLineEdit* dictionaryEdit;
     QProgressBar* progressBar;
     QLabel* statusLabel;
     QPushButton* addFileBtn;
     QPushButton* removeFileBtn;
     QPushButton* browseBtn;
+    QPushButton* dictionaryBtn;
     QPushButton* startBtn;
+    QPushButton* cancelBtn;
+    QCheckBox* packCheck;
+    JobQueue* jobQueue;
+    QStringList failures;
 
    void setupUI();
+   void setRunning(bool running);
 };
 
 #endif 
\ No newline at end of file
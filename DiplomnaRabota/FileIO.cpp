@@ -0,0 +1,178 @@
+#include "FileIO.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static constexpr size_t SINK_BUFFER = 1 << 20;
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) {
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (h == INVALID_HANDLE_VALUE) throw std::runtime_error("Cannot open input");
+    file = h;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(h, &size)) {
+        CloseHandle(h);
+        throw std::runtime_error("Cannot open input");
+    }
+    length = size_t(size.QuadPart);
+    if (length == 0) return;
+    mapping = CreateFileMappingA(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping) base = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!base) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(h);
+        throw std::runtime_error("Cannot map input");
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (base) UnmapViewOfFile(base);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+}
+
+TempMapping::TempMapping(size_t bytes)
+    : length(bytes) {
+    std::wstring dir = std::filesystem::temp_directory_path().wstring();
+    wchar_t name[MAX_PATH];
+    if (!GetTempFileNameW(dir.c_str(), L"zb", 0, name)) throw std::runtime_error("Cannot create temporary file");
+    HANDLE h = CreateFileW(name, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+    if (h == INVALID_HANDLE_VALUE) throw std::runtime_error("Cannot create temporary file");
+    file = h;
+    if (length == 0) return;
+    uint64_t size = length;
+    mapping = CreateFileMappingW(h, nullptr, PAGE_READWRITE, DWORD(size >> 32), DWORD(size), nullptr);
+    if (mapping) base = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+    if (!base) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(h);
+        throw std::runtime_error("Cannot map temporary file");
+    }
+}
+
+TempMapping::~TempMapping() {
+    if (base) UnmapViewOfFile(base);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Cannot open input");
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot open input");
+    }
+    length = size_t(st.st_size);
+    if (length > 0) {
+        void* p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Cannot map input");
+        }
+        ::madvise(p, length, MADV_SEQUENTIAL);
+        base = static_cast<const uint8_t*>(p);
+    }
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (base) ::munmap(const_cast<uint8_t*>(base), length);
+}
+
+TempMapping::TempMapping(size_t bytes)
+    : length(bytes) {
+    std::string name = (std::filesystem::temp_directory_path() / "zerobit-XXXXXX").string();
+    int fd = ::mkstemp(&name[0]);
+    if (fd < 0) throw std::runtime_error("Cannot create temporary file");
+    ::unlink(name.c_str());
+    if (length > 0) {
+        void* p = ::ftruncate(fd, off_t(length)) == 0
+            ? ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Cannot map temporary file");
+        }
+        base = p;
+    }
+    ::close(fd);
+}
+
+TempMapping::~TempMapping() {
+    if (base) ::munmap(base, length);
+}
+
+#endif
+
+// The partial file is created next to path under a random name, and only
+// when no file has that name, so neither an existing file nor another run
+// writing the same output is touched.
+FileSink::FileSink(const std::string& p)
+    : path(p), f(nullptr), buf(SINK_BUFFER) {
+    std::random_device rd;
+    std::mt19937_64 rng((uint64_t(rd()) << 32) ^ rd());
+    char suffix[32];
+    for (int attempt = 0; !f && attempt < 16; ++attempt) {
+        std::snprintf(suffix, sizeof(suffix), ".%016llx.part", (unsigned long long)rng());
+        partPath = path + suffix;
+        f = std::fopen(partPath.c_str(), "wbx");
+    }
+    if (!f) throw std::runtime_error("Cannot open output");
+}
+
+FileSink::~FileSink() {
+    if (f) {
+        std::fclose(f);
+        std::remove(partPath.c_str());
+    }
+}
+
+void FileSink::flush() {
+    if (used && std::fwrite(buf.data(), 1, used, f) != used)
+        throw std::runtime_error("Write failed");
+    used = 0;
+}
+
+void FileSink::write(const void* data, size_t n) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    if (n >= buf.size()) {
+        flush();
+        if (std::fwrite(p, 1, n, f) != n) throw std::runtime_error("Write failed");
+        return;
+    }
+    if (used + n > buf.size()) flush();
+    std::memcpy(buf.data() + used, p, n);
+    used += n;
+}
+
+void FileSink::close() {
+    flush();
+    int rc = std::fclose(f);
+    f = nullptr;
+    std::error_code ec;
+    if (rc == 0) std::filesystem::rename(partPath, path, ec);
+    if (rc != 0 || ec) {
+        std::remove(partPath.c_str());
+        throw std::runtime_error("Write failed");
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Read-only memory map of a whole file. Blocks are handed to the pipeline
+// as pointers into the mapping, so input is never copied.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    const uint8_t* base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+// Zero-filled scratch memory backed by a temporary file that is deleted
+// when closed, so working arrays larger than RAM page to disk instead of
+// failing to allocate.
+class TempMapping {
+public:
+    explicit TempMapping(size_t bytes);
+    ~TempMapping();
+
+    TempMapping(const TempMapping&) = delete;
+    TempMapping& operator=(const TempMapping&) = delete;
+
+    void* data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    void* base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+// Buffered writer straight to a C stdio handle; bypasses iostreams. Bytes
+// go to a new uniquely named file beside path, which close() renames to
+// path, replacing any file there. A sink destroyed without close(), as when an exception unwinds
+// past it, deletes the partial file instead and writes nothing more.
+class FileSink {
+public:
+    explicit FileSink(const std::string& path);
+    ~FileSink();
+
+    FileSink(const FileSink&) = delete;
+    FileSink& operator=(const FileSink&) = delete;
+
+    void write(const void* data, size_t n);
+    void close();
+
+private:
+    void flush();
+
+    std::string path;
+    std::string partPath;
+    std::FILE* f;
+    std::vector<uint8_t> buf;
+    size_t used = 0;
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "JobQueue.h"
+#include "Compressor.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+
+#include <algorithm>
+#include <string>
+
+JobQueue::JobQueue(QObject* parent)
+    : QObject(parent) {
+    timer.setInterval(100);
+    connect(&timer, &QTimer::timeout, this, &JobQueue::poll);
+}
+
+JobQueue::~JobQueue() {
+    cancelled = true;
+    pool.waitForDone();
+}
+
+void JobQueue::start(const std::vector<Job>& batch) {
+    if (running) return;
+    jobs = batch;
+    sizes.assign(jobs.size(), 0);
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (jobs[i].pack.isEmpty())
+            sizes[i] = uint64_t(QFileInfo(jobs[i].input).size());
+        for (const QString& file : jobs[i].pack)
+            sizes[i] += uint64_t(QFileInfo(file).size());
+    }
+    errors.assign(jobs.size(), QString());
+    done.reset(new std::atomic<uint64_t>[jobs.size()]);
+    for (size_t i = 0; i < jobs.size(); ++i) done[i] = 0;
+    remaining = jobs.size();
+    cancelled = false;
+    running = true;
+
+    // Files run side by side; cores left over go to each file's blocks.
+    unsigned cores = unsigned(std::max(1, QThread::idealThreadCount()));
+    pool.setMaxThreadCount(int(std::min<size_t>(cores, std::max<size_t>(jobs.size(), 1))));
+    threadsPerJob = std::max(1u, cores / unsigned(std::max<size_t>(jobs.size(), 1)));
+
+    clock.start();
+    timer.start();
+    for (size_t i = 0; i < jobs.size(); ++i)
+        pool.start([this, i] { run(i); });
+    poll();
+}
+
+void JobQueue::cancel() {
+    cancelled = true;
+}
+
+void JobQueue::run(size_t i) {
+    const Job& job = jobs[i];
+    const uint64_t size = sizes[i];
+    // Kept while the pool thread lives, so a batch of small files does not
+    // allocate fresh models for each.
+    thread_local CompressorContext context;
+    CompressorOptions opts;
+    opts.threads = threadsPerJob;
+    opts.dictionary = dictionary;
+    opts.context = &context;
+    opts.overwrite = job.replace;
+    // Decompression reports output bytes; scale them to the archive size so
+    // the batch is measured in input bytes throughout.
+    opts.progress = [this, i, size](uint64_t bytes, uint64_t total) {
+        uint64_t in = total ? uint64_t(double(bytes) / double(total) * double(size)) : 0;
+        done[i].store(std::min(in, size), std::memory_order_relaxed);
+        return !cancelled.load(std::memory_order_relaxed);
+    };
+
+    bool existed = QFileInfo::exists(job.output);
+    // Unpacking writes a directory of files rather than a single file.
+    auto removeOutput = [&] {
+        if (existed) return;
+        if (QFileInfo(job.output).isDir()) QDir(job.output).removeRecursively();
+        else QFile::remove(job.output);
+    };
+    QString& error = errors[i];
+    try {
+        if (!cancelled) {
+            std::string in = job.input.toStdString(), out = job.output.toStdString();
+            if (!job.pack.isEmpty()) {
+                std::vector<std::string> files;
+                for (const QString& file : job.pack) files.push_back(file.toStdString());
+                Compressor::packFiles(files, out, opts);
+            }
+            else if (job.decompress && Compressor::isPacked(in))
+                Compressor::unpackFiles(in, out, opts);
+            else if (job.decompress)
+                Compressor::decompress(in, out, opts);
+            else
+                Compressor::compress(in, out, opts);
+        }
+    }
+    catch (const Compressor::Cancelled&) {
+        removeOutput();
+    }
+    catch (const std::exception& e) {
+        error = QString::fromLocal8Bit(e.what());
+        removeOutput();
+    }
+    done[i].store(size, std::memory_order_relaxed);
+    --remaining;
+}
+
+void JobQueue::poll() {
+    uint64_t total = 0, sum = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        total += sizes[i];
+        sum += done[i].load(std::memory_order_relaxed);
+    }
+    double seconds = double(clock.elapsed()) / 1000.0;
+    emit progress(sum, total, seconds > 0 ? double(sum) / seconds : 0.0);
+    if (remaining == 0) {
+        timer.stop();
+        running = false;
+        for (size_t i = 0; i < jobs.size(); ++i)
+            if (!errors[i].isEmpty()) emit jobFailed(jobs[i].input, errors[i]);
+        emit finished(cancelled);
+    }
+}
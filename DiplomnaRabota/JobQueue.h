@@ -0,0 +1,75 @@
+#pragma once
+#ifndef JOBQUEUE_H
+#define JOBQUEUE_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Runs compress and decompress jobs on a thread pool, several files at a
+// time. Workers only update atomics; the UI thread samples them on a timer,
+// so progress costs nothing per block, and every signal is emitted on the
+// UI thread. Progress is counted in input bytes.
+class JobQueue : public QObject {
+    Q_OBJECT
+
+public:
+    struct Job {
+        QString input;
+        QString output;
+        bool decompress = false;
+        // When set, these files are packed into one archive at output and
+        // input is ignored.
+        QStringList pack;
+        // An existing output is replaced when the job succeeds and kept
+        // when it fails or is cancelled; see CompressorOptions::overwrite.
+        bool replace = false;
+    };
+
+    explicit JobQueue(QObject* parent = nullptr);
+    // Cancels and waits for the workers.
+    ~JobQueue() override;
+
+    // Used for the next batch; see CompressorOptions::dictionary.
+    void setDictionary(const std::string& bytes) { dictionary = bytes; }
+    void start(const std::vector<Job>& jobs);
+    // Workers stop at their next block boundary; finished() follows.
+    void cancel();
+    bool isRunning() const { return running; }
+
+signals:
+    void progress(quint64 done, quint64 total, double bytesPerSecond);
+    // Failures are reported once the whole batch is done, before finished.
+    void jobFailed(const QString& input, const QString& error);
+    void finished(bool cancelled);
+
+private:
+    void run(size_t i);
+    void poll();
+
+    std::vector<Job> jobs;
+    std::vector<uint64_t> sizes;
+    // Each worker writes only its own entries; read once all have finished.
+    std::vector<QString> errors;
+    std::unique_ptr<std::atomic<uint64_t>[]> done;
+    std::atomic<size_t> remaining{ 0 };
+    std::atomic<bool> cancelled{ false };
+    unsigned threadsPerJob = 1;
+    std::string dictionary;
+    bool running = false;
+
+    QThreadPool pool;
+    QTimer timer;
+    QElapsedTimer clock;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef LEVELS_H
+#define LEVELS_H
+
+#include "Compressor.h"
+#include "Models.h"
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+// What each compression level runs. The model mask is looked up again from
+// the recorded level when decompressing, so existing rows must not change.
+// fastEntropy only steers the encoder: blocks whose sampled byte entropy
+// reaches it are stored or LZ-coded instead of modelled. Compressed data
+// samples at 7.9 to 8 bits, where the models still save up to a tenth
+// on gzip or PNG streams, so only the fast levels give that up. Level 1
+// sets it to 0 and LZ-codes every block, skipping the BWT. With
+// chooseMtf each block is coded with or without MTF/RLE, whichever a
+// trial on a slice of its BWT output finds cheaper.
+struct LevelParams {
+    uint32_t models;
+    uint8_t tableBits;
+    bool mtf;
+    double fastEntropy;
+    bool chooseMtf;
+};
+
+inline constexpr LevelParams LEVELS[] = {
+    {},
+    { MODEL_ORDER1 | MODEL_ORDER2, 20, true, 0 },
+    { MODEL_ORDER1 | MODEL_ORDER2 | MODEL_BITS, 21, true, 7.5 },
+    { MODEL_ORDER1 | MODEL_ORDER2 | MODEL_ORDER3 | MODEL_BITS, 22, true, 7.8 },
+    { MODEL_ORDER1 | MODEL_ORDER2 | MODEL_ORDER3 | MODEL_ORDER4 | MODEL_BITS, 23, true, 7.8 },
+    { MODEL_ALL & ~MODEL_MATCH8 & ~MODEL_LZP, 24, true, 7.8 },
+    { MODEL_ALL, 26, true, 7.99 },
+    { MODEL_ALL, 27, true, 7.99 },
+    { MODEL_ALL, 27, true, 7.99, true },
+    { MODEL_ALL, 28, true, 7.99, true },
+};
+
+inline const LevelParams& levelParams(int level) {
+    if (level < Compressor::MIN_LEVEL || level > Compressor::MAX_LEVEL)
+        throw std::runtime_error("Invalid compression level");
+    return LEVELS[level];
+}
+
+template <typename Pipeline>
+struct PipelineTag {
+    using type = Pipeline;
+};
+
+// Calls f(PipelineTag<P>()) with the ModelPipeline type of the given level,
+// so the caller's coder loop is compiled once per distinct model set.
+template <int Level = Compressor::MIN_LEVEL, typename F>
+void withModelPipeline(int level, F&& f) {
+    if constexpr (Level > Compressor::MAX_LEVEL) {
+        throw std::runtime_error("Invalid compression level");
+    }
+    else {
+        if (level == Level) f(PipelineTag<ModelPipelineFor<LEVELS[Level].models>>());
+        else withModelPipeline<Level + 1>(level, std::forward<F>(f));
+    }
+}
+
+#endif
@@ -0,0 +1,38 @@
+#include "Logistic.h"
+
+namespace logistic {
+
+int16_t stretchTable[4096];
+uint16_t squashTable[4096];
+
+namespace {
+
+// 65536 / (1 + exp(-x / 2)) for x = -16..16.
+constexpr int KNOTS[33] = {
+    22, 36, 60, 98, 162, 267, 439, 720, 1179, 1921, 3108, 4971, 7812, 11955, 17625, 24743,
+    32768, 40793, 47911, 53581, 57724, 60565, 62428, 63615, 64357, 64816, 65097, 65269,
+    65374, 65438, 65476, 65500, 65514
+};
+
+struct TableInit {
+    TableInit() {
+        for (int d = -2048; d < 2048; ++d) {
+            int i = d + 2048;
+            int w = i & 127, k = i >> 7;
+            squashTable[i] = uint16_t((KNOTS[k] * (128 - w) + KNOTS[k + 1] * w + 64) >> 7);
+        }
+        int pi = 0;
+        for (int x = -2047; x <= 2047; ++x) {
+            int v = squash(x);
+            for (int j = pi; j <= v; ++j) stretchTable[j] = int16_t(x);
+            pi = v + 1;
+        }
+        for (int j = pi; j < 4096; ++j) stretchTable[j] = 2047;
+    }
+};
+
+const TableInit init;
+
+}
+
+}
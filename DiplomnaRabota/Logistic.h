@@ -0,0 +1,25 @@
+#ifndef LOGISTIC_H
+#define LOGISTIC_H
+
+#include <cstdint>
+
+// Fixed-point logistic helpers. Logits are 8.8 fixed point in [-2047, 2047],
+// probabilities are 16-bit (squash16) or 12-bit (squash, stretch input).
+// Tables are built from integer knots so every platform codes identically.
+namespace logistic {
+
+extern int16_t stretchTable[4096];
+extern uint16_t squashTable[4096];
+
+inline int clampLogit(int d) {
+    return d > 2047 ? 2047 : (d < -2047 ? -2047 : d);
+}
+
+inline int stretch(int p12) { return stretchTable[p12]; }
+inline int stretch16(uint16_t p16) { return stretchTable[p16 >> 4]; }
+inline uint16_t squash16(int d) { return squashTable[clampLogit(d) + 2048]; }
+inline int squash(int d) { return squash16(d) >> 4; }
+
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include "Lz.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t MAX_OFFSET = 65535;
+constexpr unsigned HASH_BITS = 16;
+// Misses in a row before the search starts skipping ahead; every further
+// 32 misses widen the step by one byte.
+constexpr unsigned SKIP_SHIFT = 5;
+
+[[noreturn]] void corrupt() {
+    throw std::runtime_error("Corrupt block");
+}
+
+uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Lengths of 15 and more continue in bytes of 255 and a final smaller one.
+void putLength(std::vector<uint8_t>& out, size_t v) {
+    for (; v >= 255; v -= 255) out.push_back(255);
+    out.push_back(uint8_t(v));
+}
+
+}
+
+// Each sequence is a token holding the literal count in its high nibble
+// and the match length less MIN_MATCH in its low one, the literals, then
+// the match offset (uint16_t). The final sequence has literals only.
+std::vector<uint8_t> lzCompress(const uint8_t* data, size_t n) {
+    std::vector<uint8_t> out;
+    out.reserve(n + n / 255 + 16);
+    auto sequence = [&](size_t anchor, size_t literals, size_t offset, size_t match) {
+        size_t ml = match ? match - MIN_MATCH : 0;
+        out.push_back(uint8_t((literals < 15 ? literals : 15) << 4 | (ml < 15 ? ml : 15)));
+        if (literals >= 15) putLength(out, literals - 15);
+        out.insert(out.end(), data + anchor, data + anchor + literals);
+        if (!match) return;
+        out.push_back(uint8_t(offset));
+        out.push_back(uint8_t(offset >> 8));
+        if (ml >= 15) putLength(out, ml - 15);
+    };
+
+    std::vector<size_t> table(size_t(1) << HASH_BITS, 0);
+    size_t anchor = 0;
+    size_t misses = 0;
+    for (size_t i = 0; i + MIN_MATCH <= n;) {
+        uint32_t v = read32(data + i);
+        size_t& slot = table[hash(v)];
+        size_t c = slot;
+        slot = i;
+        if (c < i && i - c <= MAX_OFFSET && read32(data + c) == v) {
+            size_t len = MIN_MATCH;
+            while (i + len < n && data[c + len] == data[i + len]) ++len;
+            sequence(anchor, i - anchor, i - c, len);
+            i += len;
+            anchor = i;
+            misses = 0;
+        }
+        else {
+            i += 1 + (misses++ >> SKIP_SHIFT);
+        }
+    }
+    sequence(anchor, n - anchor, 0, 0);
+    return out;
+}
+
+std::string lzDecompress(const uint8_t* data, size_t size, size_t n) {
+    std::string out(n, '\0');
+    char* dst = &out[0];
+    size_t ip = 0, op = 0;
+    auto length = [&](size_t v) {
+        if (v < 15) return v;
+        uint8_t b;
+        do {
+            if (ip == size) corrupt();
+            b = data[ip++];
+            v += b;
+        } while (b == 255);
+        return v;
+    };
+    for (;;) {
+        if (ip == size) corrupt();
+        uint8_t token = data[ip++];
+        size_t literals = length(token >> 4);
+        if (literals > size - ip || literals > n - op) corrupt();
+        std::memcpy(dst + op, data + ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == size) break;
+        if (size - ip < 2) corrupt();
+        size_t offset = size_t(data[ip]) | size_t(data[ip + 1]) << 8;
+        ip += 2;
+        size_t match = length(token & 15) + MIN_MATCH;
+        if (offset == 0 || offset > op || match > n - op) corrupt();
+        if (offset >= match) {
+            std::memcpy(dst + op, dst + op - offset, match);
+        }
+        else {
+            for (size_t k = 0; k < match; ++k) dst[op + k] = dst[op + k - offset];
+        }
+        op += match;
+    }
+    if (op != n) corrupt();
+    return out;
+}
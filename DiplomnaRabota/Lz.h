@@ -0,0 +1,18 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Byte-oriented LZ77 with a 64 KiB window and no entropy coding, for blocks
+// where the full pipeline costs far more time than it saves. Incompressible
+// stretches are skipped over faster the longer they run.
+std::vector<uint8_t> lzCompress(const uint8_t* data, size_t n);
+
+// Inverse of lzCompress for a block of n bytes; throws std::runtime_error
+// on malformed input.
+std::string lzDecompress(const uint8_t* data, size_t size, size_t n);
+
+#endif
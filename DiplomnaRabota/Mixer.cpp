@@ -0,0 +1,138 @@
+#include "Mixer.h"
+#include "Logistic.h"
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+int dotProduct(const int16_t* x, const int16_t* w, size_t n) {
+#if defined(__AVX2__)
+    __m256i sum = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += 16) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + i));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(a, b));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(s);
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128i sum = _mm_setzero_si128();
+    for (size_t i = 0; i < n; i += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(a, b));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+#else
+    int sum = 0;
+    for (size_t i = 0; i < n; ++i) sum += x[i] * w[i];
+    return sum;
+#endif
+}
+
+inline int16_t saturate16(int v) {
+    return int16_t(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+}
+
+// w += round(x * err / 65536), saturating; every path rounds identically.
+void train(const int16_t* x, int16_t* w, size_t n, int err) {
+#if defined(__AVX2__)
+    const __m256i e = _mm256_set1_epi16(int16_t(err));
+    const __m256i one = _mm256_set1_epi16(1);
+    for (size_t i = 0; i < n; i += 16) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<__m256i*>(w + i));
+        a = _mm256_mulhi_epi16(_mm256_adds_epi16(a, a), e);
+        a = _mm256_srai_epi16(_mm256_adds_epi16(a, one), 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(w + i), _mm256_adds_epi16(b, a));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128i e = _mm_set1_epi16(int16_t(err));
+    const __m128i one = _mm_set1_epi16(1);
+    for (size_t i = 0; i < n; i += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i*>(w + i));
+        a = _mm_mulhi_epi16(_mm_adds_epi16(a, a), e);
+        a = _mm_srai_epi16(_mm_adds_epi16(a, one), 1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(w + i), _mm_adds_epi16(b, a));
+    }
+#else
+    for (size_t i = 0; i < n; ++i) {
+        int d = ((saturate16(x[i] * 2) * err) >> 16) + 1;
+        w[i] = saturate16(w[i] + (d >> 1));
+    }
+#endif
+}
+
+}
+
+Mixer::Mixer(size_t inputs, size_t contexts, int learningRate)
+    : stride((inputs + LANES - 1) / LANES * LANES),
+    tx(stride, 0),
+    w(stride * contexts, 4096),
+    lr(learningRate) {
+}
+
+void Mixer::reset() {
+    std::fill(tx.begin(), tx.end(), int16_t(0));
+    std::fill(w.begin(), w.end(), int16_t(4096));
+    nx = 0;
+    row = 0;
+    pr = 2048;
+}
+
+uint16_t Mixer::mix(size_t ctx) {
+    row = ctx * stride;
+    int dot = dotProduct(tx.data(), &w[row], stride) >> 14;
+    uint16_t p = logistic::squash16(dot);
+    pr = p >> 4;
+    return p;
+}
+
+void Mixer::update(int bit) {
+    int err = ((bit << 12) - pr) * lr;
+    train(tx.data(), &w[row], stride, err);
+    nx = 0;
+}
+
+std::vector<double> Mixer::meanWeights(size_t n) const {
+    std::vector<double> mean(n);
+    size_t rows = w.size() / stride;
+    for (size_t r = 0; r < rows; ++r)
+        for (size_t i = 0; i < n; ++i) mean[i] += w[r * stride + i];
+    for (double& m : mean) m /= double(rows) * 16384;
+    return mean;
+}
+
+Apm::Apm(size_t contexts, int r)
+    : t(contexts * 24), rate(r) {
+    reset();
+}
+
+void Apm::reset() {
+    index = 0;
+    for (size_t i = 0; i < t.size(); ++i)
+        t[i] = logistic::squash16(int((i % 24) * 2 + 1) * 4096 / 48 - 2048);
+}
+
+uint16_t Apm::refine(uint16_t p16, size_t ctx) {
+    int s = (logistic::stretch16(p16) + 2048) * 23;
+    int wt = s & 0xFFF;
+    size_t base = ctx * 24 + (s >> 12);
+    index = base + (wt >> 11);
+    return uint16_t((t[base] * (4096 - wt) + t[base + 1] * wt) >> 12);
+}
+
+void Apm::update(int bit) {
+    int g = (bit << 16) + (bit << rate) - bit - bit;
+    t[index] = uint16_t(t[index] + ((g - t[index]) >> rate));
+}
@@ -0,0 +1,52 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Gated logistic mixer. Callers add() one stretched prediction per input,
+// then mix() and update() reuse those cached inputs. One weight row is
+// kept per context; rows are padded to whole SIMD registers of int16.
+class Mixer {
+    static constexpr size_t LANES = 16;
+
+    size_t stride;
+    std::vector<int16_t> tx;
+    std::vector<int16_t> w;
+    size_t nx = 0;
+    size_t row = 0;
+    int pr = 2048;
+    int lr;
+
+public:
+    Mixer(size_t inputs, size_t contexts, int learningRate = 7);
+
+    void reset();
+
+    void add(int st) { tx[nx++] = int16_t(st); }
+    uint16_t mix(size_t ctx);
+    void update(int bit);
+
+    // Weight of each of the first n inputs averaged over all contexts,
+    // where 1.0 passes an input through unscaled.
+    std::vector<double> meanWeights(size_t n) const;
+};
+
+// Adaptive probability map: refines a probability given a small context by
+// interpolating between 24 learned buckets along the stretched axis.
+class Apm {
+    std::vector<uint16_t> t;
+    size_t index = 0;
+    int rate;
+
+public:
+    explicit Apm(size_t contexts, int rate = 7);
+
+    void reset();
+
+    uint16_t refine(uint16_t p16, size_t ctx);
+    void update(int bit);
+};
+
+#endif
@@ -0,0 +1,613 @@
+#ifndef MODELS_H
+#define MODELS_H
+
+#include "ContextTable.h"
+#include "Logistic.h"
+#include "Mixer.h"
+#include "StateMap.h"
+#include "Stats.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Interface for models plugged into a ModelSet at run time. The built-in
+// models also implement it, but are final so a ModelPipeline can call them
+// directly.
+class IModel {
+public:
+    virtual ~IModel() = default;
+    virtual uint16_t predict() const = 0;
+    virtual void updateBit(int bit) = 0;
+    virtual void updateByte(uint8_t b) = 0;
+};
+
+// Order-n byte context: the last n bytes are hashed once per byte, and
+// once more with the high nibble of the current byte after four bits.
+template <uint32_t Order>
+class ByteContextModel final : public IModel {
+    static constexpr uint32_t order = Order;
+
+    ContextTable& table;
+    StateMap sm;
+    uint32_t hist = 0;
+    uint32_t ctxHash = 0;
+    uint8_t* slot;
+    uint32_t c0 = 1;
+    uint32_t node = 1;
+#ifdef ZEROBIT_STATS
+    stats::Lookups lookups;
+#endif
+
+public:
+    static std::string name() { return "order" + std::to_string(Order); }
+
+    explicit ByteContextModel(ContextTable& t)
+        : table(t) {
+        ctxHash = hashContext(0, order);
+        slot = table.find(ctxHash);
+    }
+
+    // Back to the constructed state; the table must be reset first.
+    void reset() {
+        sm.reset();
+        hist = 0;
+        ctxHash = hashContext(0, order);
+        slot = table.find(ctxHash);
+        c0 = 1;
+        node = 1;
+    }
+
+    uint16_t predict() const override {
+        return sm.p(slot[node - 1]);
+    }
+
+    void updateBit(int bit) override {
+        uint8_t& st = slot[node - 1];
+        sm.update(st, bit);
+        st = bithistory::next(st, bit);
+        c0 = (c0 << 1) | uint32_t(bit);
+        node = (node << 1) | uint32_t(bit);
+        if (node >= 16) {
+            node = 1;
+            if (c0 < 256) {
+                slot = table.find(hashContext(ctxHash, c0));
+#ifdef ZEROBIT_STATS
+                lookups.count(slot[0] != 0);
+#endif
+            }
+        }
+    }
+
+    void updateByte(uint8_t b) override {
+        hist = (hist << 8) | b;
+        uint32_t ctx = hist;
+        if constexpr (order < 4) ctx &= (1u << (8 * order)) - 1;
+        ctxHash = hashContext(ctx, order);
+        slot = table.find(ctxHash);
+        c0 = 1;
+        node = 1;
+#ifdef ZEROBIT_STATS
+        lookups.count(slot[0] != 0);
+#endif
+    }
+
+#ifdef ZEROBIT_STATS
+    void collect(CompressorStats::Model& m) { lookups.collect(m); }
+#endif
+};
+
+// Context of the last `Order` coded bits, looked up at every nibble
+// boundary of the bit stream and extended by the bits seen since.
+template <uint32_t Order>
+class BitContextModel final : public IModel {
+    static constexpr uint32_t mask = Order >= 32 ? 0xFFFFFFFF : (1u << Order) - 1;
+
+    ContextTable& table;
+    StateMap sm;
+    uint32_t hist = 0;
+    uint8_t* slot;
+    uint32_t node = 1;
+#ifdef ZEROBIT_STATS
+    stats::Lookups lookups;
+#endif
+
+public:
+    static std::string name() { return "bits" + std::to_string(Order); }
+
+    explicit BitContextModel(ContextTable& t)
+        : table(t) {
+        slot = table.find(hashContext(0, 0x100 | Order));
+    }
+
+    void reset() {
+        sm.reset();
+        hist = 0;
+        slot = table.find(hashContext(0, 0x100 | Order));
+        node = 1;
+    }
+
+    uint16_t predict() const override {
+        return sm.p(slot[node - 1]);
+    }
+
+    void updateBit(int bit) override {
+        uint8_t& st = slot[node - 1];
+        sm.update(st, bit);
+        st = bithistory::next(st, bit);
+        hist = ((hist << 1) | uint32_t(bit)) & mask;
+        node = (node << 1) | uint32_t(bit);
+        if (node >= 16) {
+            slot = table.find(hashContext(hist, 0x100 | mask));
+            node = 1;
+#ifdef ZEROBIT_STATS
+            lookups.count(slot[0] != 0);
+#endif
+        }
+    }
+
+    void updateByte(uint8_t) override {
+    }
+
+#ifdef ZEROBIT_STATS
+    void collect(CompressorStats::Model& m) { lookups.collect(m); }
+#endif
+};
+
+// Finds the most recent earlier occurrence of the last MinLen bytes and
+// predicts that the byte which followed it comes next. Candidates come from
+// a hash of the last MinLen bytes with a few slots per bucket; the longest
+// verified one wins. A match then extends by one compare per byte until a
+// byte differs. The confidence is learned per match length, using the
+// bit-history state with that many agreeing observations as the context.
+template <size_t MinLen>
+class MatchModel final : public IModel {
+    static_assert(MinLen >= 1 && MinLen <= 8, "the hash covers at most 8 bytes");
+
+    static constexpr uint32_t WINDOW_BITS = 22;
+    static constexpr uint32_t WINDOW_MASK = (1u << WINDOW_BITS) - 1;
+    static constexpr uint32_t HASH_BITS = 18;
+    static constexpr size_t SLOTS = 4;
+    static constexpr uint32_t MAX_VERIFY = 32;
+    static constexpr uint32_t MAX_LEN = 65535;
+
+    std::vector<uint8_t> buf;
+    std::vector<uint32_t> table;
+    StateMap sm;
+    uint64_t recent = 0;
+    uint64_t coded = 0;
+    uint32_t pos = 0;
+    uint32_t ptr = 0;
+    uint32_t len = 0;
+    uint32_t bitPos = 0;
+    uint8_t expected = 0;
+    uint8_t ctx = 0;
+    bool active = false;
+#ifdef ZEROBIT_STATS
+    stats::Lookups lookups;
+    std::array<uint64_t, stats::LENGTH_BUCKETS> lengths{};
+#endif
+
+    static uint8_t lengthState(uint32_t n, int bit) {
+        uint32_t bucket = n < 14 ? n : (n < 32 ? 14 : 15);
+        return uint8_t(bit ? bucket << 4 : bucket);
+    }
+
+    static uint32_t hash(uint64_t last) {
+        uint64_t key = MinLen >= 8 ? last : last & ((uint64_t(1) << (8 * MinLen)) - 1);
+        return uint32_t((key * 0x9E3779B97F4A7C15ull) >> (64 - HASH_BITS));
+    }
+
+    // Bytes before pos and before candidate c that agree, up to MAX_VERIFY.
+    uint32_t verify(uint32_t c) const {
+        uint32_t n = 0;
+        while (n < MAX_VERIFY && n < c && buf[(c - 1 - n) & WINDOW_MASK] == buf[(pos - 1 - n) & WINDOW_MASK])
+            ++n;
+        return n;
+    }
+
+    void setExpected() {
+        active = len > 0;
+        expected = buf[ptr & WINDOW_MASK];
+    }
+
+public:
+    static std::string name() { return "match" + std::to_string(MinLen); }
+
+    MatchModel()
+        : buf(size_t(1) << WINDOW_BITS, 0), table((size_t(1) << HASH_BITS) * SLOTS, 0) {
+    }
+
+    // Back to the constructed state. A short input is replayed to clear
+    // just the buckets it touched; a long one clears everything.
+    void reset() {
+        if (coded > (uint64_t(1) << HASH_BITS)) {
+            std::fill(buf.begin(), buf.end(), uint8_t(0));
+            std::fill(table.begin(), table.end(), 0u);
+        }
+        else {
+            uint64_t r = 0;
+            for (uint32_t i = 0; i < pos; ++i) {
+                r = (r << 8) | buf[i];
+                buf[i] = 0;
+                if (i + 1 >= MinLen) std::fill_n(&table[size_t(hash(r)) * SLOTS], SLOTS, 0u);
+            }
+        }
+        sm.reset();
+        recent = 0;
+        coded = 0;
+        pos = ptr = len = bitPos = 0;
+        expected = ctx = 0;
+        active = false;
+    }
+
+    uint16_t predict() const override {
+        if (!active) return 32768;
+        return sm.p(ctx);
+    }
+
+    void updateBit(int bit) override {
+        if (active) {
+            sm.update(ctx, bit);
+            if (bit != ((expected >> (7 - bitPos)) & 1)) active = false;
+        }
+        if (++bitPos < 8 && active)
+            ctx = lengthState(len, (expected >> (7 - bitPos)) & 1);
+    }
+
+    void updateByte(uint8_t b) override {
+        buf[pos & WINDOW_MASK] = b;
+        ++pos;
+        ++coded;
+        recent = (recent << 8) | b;
+        bitPos = 0;
+
+        if (len > 0 && expected == b) {
+            if (len < MAX_LEN) ++len;
+            ++ptr;
+        }
+        else {
+            len = 0;
+        }
+
+#ifdef ZEROBIT_STATS
+        ++lengths[stats::lengthBucket(len)];
+#endif
+        if (pos < MinLen) return;
+        uint32_t* bucket = &table[size_t(hash(recent)) * SLOTS];
+        if (len == 0) {
+            for (size_t k = 0; k < SLOTS; ++k) {
+                uint32_t c = bucket[k];
+                if (c == 0 || pos - c > WINDOW_MASK - MAX_VERIFY) continue;
+                uint32_t n = verify(c);
+                if (n >= MinLen && n > len) { len = n; ptr = c; }
+            }
+#ifdef ZEROBIT_STATS
+            lookups.count(len > 0);
+#endif
+        }
+        for (size_t k = SLOTS - 1; k > 0; --k) bucket[k] = bucket[k - 1];
+        bucket[0] = pos;
+        setExpected();
+        if (active) ctx = lengthState(len, expected >> 7);
+    }
+
+#ifdef ZEROBIT_STATS
+    void collect(CompressorStats::Model& m) {
+        lookups.collect(m);
+        m.matchLengths.resize(stats::LENGTH_BUCKETS);
+        for (size_t i = 0; i < lengths.size(); ++i) m.matchLengths[i] += lengths[i];
+        lengths.fill(0);
+    }
+#endif
+};
+
+class LZPModel final : public IModel {
+    static constexpr size_t N = 1 << 20;
+    static constexpr uint32_t NONE = UINT32_MAX;
+    std::vector<uint8_t> buf;
+    std::vector<uint32_t> nxt;
+    size_t pos = 0;
+    size_t coded = 0;
+    uint8_t prev = 0;
+#ifdef ZEROBIT_STATS
+    stats::Lookups lookups;
+#endif
+
+public:
+    static std::string name() { return "lzp"; }
+
+    LZPModel()
+        : buf(N),
+        nxt(N, NONE)
+    {
+    }
+
+    // Back to the constructed state, clearing only the entries written
+    // since the last reset: positions coded so far, and the key heads.
+    void reset() {
+        if (coded >= N) {
+            std::fill(buf.begin(), buf.end(), uint8_t(0));
+            std::fill(nxt.begin(), nxt.end(), NONE);
+        }
+        else {
+            std::fill_n(buf.begin(), coded, uint8_t(0));
+            std::fill_n(nxt.begin(), std::max(coded, size_t(1) << 16), NONE);
+        }
+        pos = 0;
+        coded = 0;
+        prev = 0;
+    }
+
+    uint16_t predict() const override {
+        uint32_t p = nxt[pos];
+        if (p == NONE) return 32768;
+        uint8_t nb = buf[(p + 1) % N];
+        return (nb & 0x80) ? 49152 : 16384;
+    }
+
+    void updateBit(int) override {
+    }
+
+    void updateByte(uint8_t b) override {
+        buf[pos] = b;
+        size_t key = (size_t(prev) << 8) | b;
+#ifdef ZEROBIT_STATS
+        lookups.count(nxt[key % N] != NONE);
+#endif
+        nxt[pos] = nxt[key % N];
+        nxt[key % N] = uint32_t(pos);
+        ++coded;
+        prev = b;
+        pos = (pos + 1) % N;
+    }
+
+#ifdef ZEROBIT_STATS
+    void collect(CompressorStats::Model& m) { lookups.collect(m); }
+#endif
+};
+
+// Bits selecting the models a ModelSet instantiates. Archives record the
+// compression level, which maps to a fixed mask, so these values are part
+// of the format.
+enum ModelMask : uint32_t {
+    MODEL_ORDER1 = 1 << 0,
+    MODEL_ORDER2 = 1 << 1,
+    MODEL_ORDER3 = 1 << 2,
+    MODEL_ORDER4 = 1 << 3,
+    MODEL_BITS = 1 << 4,
+    MODEL_MATCH4 = 1 << 5,
+    MODEL_MATCH8 = 1 << 6,
+    MODEL_LZP = 1 << 7,
+    MODEL_ALL = 0xFF
+};
+
+// Run-time model set: any mix of IModel implementations, called through
+// the interface. The compressor itself uses ModelPipeline.
+struct ModelSet {
+    ContextTable table;
+    std::vector<std::unique_ptr<IModel>> mods;
+    Mixer mixer;
+    Apm apm{ 256 };
+    uint32_t c0 = 1;
+
+    ModelSet(size_t tableBytes, uint32_t models = MODEL_ALL)
+        : table(tableBytes), mods(makeModels(table, models)), mixer(mods.size() + 1, 256) {
+    }
+    ModelSet(const ModelSet&) = delete;
+    ModelSet& operator=(const ModelSet&) = delete;
+
+    static std::vector<std::unique_ptr<IModel>> makeModels(ContextTable& t, uint32_t models) {
+        std::vector<std::unique_ptr<IModel>> m;
+        if (models & MODEL_ORDER1) m.push_back(std::make_unique<ByteContextModel<1>>(t));
+        if (models & MODEL_ORDER2) m.push_back(std::make_unique<ByteContextModel<2>>(t));
+        if (models & MODEL_ORDER3) m.push_back(std::make_unique<ByteContextModel<3>>(t));
+        if (models & MODEL_ORDER4) m.push_back(std::make_unique<ByteContextModel<4>>(t));
+        if (models & MODEL_BITS) m.push_back(std::make_unique<BitContextModel<24>>(t));
+        if (models & MODEL_MATCH4) m.push_back(std::make_unique<MatchModel<4>>());
+        if (models & MODEL_MATCH8) m.push_back(std::make_unique<MatchModel<8>>());
+        if (models & MODEL_LZP) m.push_back(std::make_unique<LZPModel>());
+        return m;
+    }
+
+    uint16_t predict() {
+        for (auto& m : mods)
+            mixer.add(logistic::stretch16(m->predict()));
+        mixer.add(256);
+        uint16_t p = mixer.mix(c0);
+        return uint16_t((p + 3 * apm.refine(p, c0)) >> 2);
+    }
+
+    void update(int bit) {
+        mixer.update(bit);
+        apm.update(bit);
+        for (auto& m : mods)
+            m->updateBit(bit);
+        c0 = (c0 << 1) | uint32_t(bit);
+        if (c0 >= 256) {
+            for (auto& m : mods)
+                m->updateByte(uint8_t(c0));
+            c0 = 1;
+        }
+    }
+};
+
+// The same mixing as ModelSet over a fixed list of models, so every call is
+// direct and the whole predict/update step can be inlined into the coder
+// loop. Each model is constructed from the shared table when it takes one.
+template <typename... Models>
+struct ModelPipeline {
+    ContextTable table;
+    std::tuple<Models...> mods;
+    Mixer mixer{ sizeof...(Models) + 1, 256 };
+    Apm apm{ 256 };
+    uint32_t c0 = 1;
+#ifdef ZEROBIT_STATS
+    stats::PipelineProbe<sizeof...(Models)> probe;
+#endif
+
+    explicit ModelPipeline(size_t tableBytes)
+        : table(tableBytes), mods(make<Models>(table)...) {
+    }
+    ModelPipeline(const ModelPipeline&) = delete;
+    ModelPipeline& operator=(const ModelPipeline&) = delete;
+
+    // Back to the state of a freshly constructed pipeline, reusing its
+    // memory. The models' initial lookups fall in distinct buckets of the
+    // table at every size, so resetting them after it rebuilds the same
+    // table state.
+    void reset() {
+        table.reset();
+        std::apply([](auto&... m) { (m.reset(), ...); }, mods);
+        mixer.reset();
+        apm.reset();
+        c0 = 1;
+#ifdef ZEROBIT_STATS
+        CompressorStats discarded;
+        collect(discarded);
+#endif
+    }
+
+    template <typename M>
+    static M make(ContextTable& t) {
+        if constexpr (std::is_constructible_v<M, ContextTable&>) return M(t);
+        else return M();
+    }
+
+#ifndef ZEROBIT_STATS
+    uint16_t predict() {
+        std::apply([this](auto&... m) { (mixer.add(logistic::stretch16(m.predict())), ...); }, mods);
+        mixer.add(256);
+        uint16_t p = mixer.mix(c0);
+        return uint16_t((p + 3 * apm.refine(p, c0)) >> 2);
+    }
+
+    void update(int bit) {
+        mixer.update(bit);
+        apm.update(bit);
+        std::apply([bit](auto&... m) { (m.updateBit(bit), ...); }, mods);
+        c0 = (c0 << 1) | uint32_t(bit);
+        if (c0 >= 256) {
+            uint8_t byte = uint8_t(c0);
+            std::apply([byte](auto&... m) { (m.updateByte(byte), ...); }, mods);
+            c0 = 1;
+        }
+    }
+#else
+    // The same steps as above, with every model's prediction scored and
+    // its calls timed on sampled bytes.
+    uint16_t predict() {
+        stats::Timer timer(probe.timePipeline);
+        size_t i = 0;
+        std::apply([&](auto&... m) { (predictOne(i++, m), ...); }, mods);
+        mixer.add(256);
+        uint16_t p = mixer.mix(c0);
+        p = uint16_t((p + 3 * apm.refine(p, c0)) >> 2);
+        probe.mixed = p;
+        probe.pipelineSeconds += timer.seconds();
+        return p;
+    }
+
+    void update(int bit) {
+        for (size_t i = 0; i < probe.p.size(); ++i) probe.loss[i] += stats::cost(probe.p[i], bit);
+        probe.mixedLoss += stats::cost(probe.mixed, bit);
+        ++probe.bits;
+        stats::Timer timer(probe.timePipeline);
+        mixer.update(bit);
+        apm.update(bit);
+        size_t i = 0;
+        std::apply([&](auto&... m) { (timed(i++, [&] { m.updateBit(bit); }), ...); }, mods);
+        c0 = (c0 << 1) | uint32_t(bit);
+        if (c0 >= 256) {
+            uint8_t byte = uint8_t(c0);
+            i = 0;
+            std::apply([&](auto&... m) { (timed(i++, [&] { m.updateByte(byte); }), ...); }, mods);
+            c0 = 1;
+            probe.pipelineSeconds += timer.seconds();
+            probe.nextByte();
+            return;
+        }
+        probe.pipelineSeconds += timer.seconds();
+    }
+
+    // Moves what was counted since the last call into s.
+    void collect(CompressorStats& s) {
+        double modelScale = probe.modelSamples ? double(probe.bytes) / double(probe.modelSamples) : 0;
+        double pipelineScale = probe.pipelineSamples ? double(probe.bytes) / double(probe.pipelineSamples) : 0;
+        if (s.models.size() < sizeof...(Models)) s.models.resize(sizeof...(Models));
+        size_t i = 0;
+        std::apply([&](auto&... m) { (collectOne(i++, m, s.models, modelScale), ...); }, mods);
+        s.modelling.seconds += probe.pipelineSeconds * pipelineScale;
+        s.mixedLossBits += probe.mixedLoss;
+        s.mixerWeights.push_back(mixer.meanWeights(sizeof...(Models) + 1));
+        s.tableSlots = table.slots();
+        s.tableUsed = table.usedSlots();
+        s.tableEvictions += table.takeEvictions();
+        probe = stats::PipelineProbe<sizeof...(Models)>();
+    }
+
+private:
+    template <typename M>
+    void predictOne(size_t i, const M& m) {
+        stats::Timer timer(probe.timeModels);
+        uint16_t p = m.predict();
+        probe.seconds[i] += timer.seconds();
+        probe.p[i] = p;
+        mixer.add(logistic::stretch16(p));
+    }
+
+    template <typename F>
+    void timed(size_t i, F&& f) {
+        stats::Timer timer(probe.timeModels);
+        f();
+        probe.seconds[i] += timer.seconds();
+    }
+
+    template <typename M>
+    void collectOne(size_t i, M& m, std::vector<CompressorStats::Model>& out, double scale) {
+        CompressorStats::Model& e = out[i];
+        e.name = M::name();
+        e.seconds += probe.seconds[i] * scale;
+        e.bits += probe.bits;
+        e.lossBits += probe.loss[i];
+        m.collect(e);
+    }
+#endif
+};
+
+namespace detail {
+
+template <bool On, typename M>
+using OptionalModel = std::conditional_t<On, std::tuple<M>, std::tuple<>>;
+
+template <typename Tuple>
+struct PipelineOf;
+
+template <typename... Models>
+struct PipelineOf<std::tuple<Models...>> {
+    using type = ModelPipeline<Models...>;
+};
+
+}
+
+// The ModelPipeline holding the models in a ModelMask, in the same order
+// as ModelSet, so both produce identical output.
+template <uint32_t Mask>
+using ModelPipelineFor = typename detail::PipelineOf<decltype(std::tuple_cat(
+    std::declval<detail::OptionalModel<(Mask & MODEL_ORDER1) != 0, ByteContextModel<1>>>(),
+    std::declval<detail::OptionalModel<(Mask & MODEL_ORDER2) != 0, ByteContextModel<2>>>(),
+    std::declval<detail::OptionalModel<(Mask & MODEL_ORDER3) != 0, ByteContextModel<3>>>(),
+    std::declval<detail::OptionalModel<(Mask & MODEL_ORDER4) != 0, ByteContextModel<4>>>(),
+    std::declval<detail::OptionalModel<(Mask & MODEL_BITS) != 0, BitContextModel<24>>>(),
+    std::declval<detail::OptionalModel<(Mask & MODEL_MATCH4) != 0, MatchModel<4>>>(),
+    std::declval<detail::OptionalModel<(Mask & MODEL_MATCH8) != 0, MatchModel<8>>>(),
+    std::declval<detail::OptionalModel<(Mask & MODEL_LZP) != 0, LZPModel>>()))>::type;
+
+#endif
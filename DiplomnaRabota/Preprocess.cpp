@@ -0,0 +1,380 @@
+#include "Preprocess.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr size_t MIN_ROWS = 8;
+constexpr size_t MAX_COLUMNS = 255;
+constexpr int MAX_DIGITS = 17;
+constexpr int64_t MAX_VALUE = 100000000000000000;  // 10^MAX_DIGITS
+constexpr uint8_t NO_FINAL_NEWLINE = 1;
+
+[[noreturn]] void corrupt() {
+    throw std::runtime_error("Corrupt block");
+}
+
+// Reads filter headers and payloads, treating any overrun as corruption.
+class Cursor {
+    const char* p;
+    const char* end;
+public:
+    explicit Cursor(const std::string& s) : p(s.data()), end(s.data() + s.size()) {}
+
+    bool atEnd() const { return p == end; }
+    uint8_t byte() { if (p == end) corrupt(); return uint8_t(*p++); }
+    uint32_t u32() {
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) v |= uint32_t(byte()) << (8 * i);
+        return v;
+    }
+    std::string_view bytes(size_t n) {
+        if (size_t(end - p) < n) corrupt();
+        std::string_view v(p, n);
+        p += n;
+        return v;
+    }
+    // Bytes up to the first of a or b, which is consumed and returned in stop.
+    std::string_view until(char a, char b, char& stop) {
+        const char* q = p;
+        while (q != end && *q != a && *q != b) ++q;
+        if (q == end) corrupt();
+        std::string_view v(p, size_t(q - p));
+        stop = *q;
+        p = q + 1;
+        return v;
+    }
+};
+
+void putU32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out += char(v >> (8 * i));
+}
+
+// Fixed-point decimals: an optional '-', an integer part without leading
+// zeros and an optional fraction. Only the canonical spelling of a value
+// is accepted, so formatFixed(parseFixed(s)) == s always holds.
+bool parseFixed(std::string_view s, int& decimals, int64_t& value) {
+    size_t i = 0;
+    bool neg = !s.empty() && s[0] == '-';
+    if (neg) ++i;
+    size_t intStart = i;
+    int digits = 0;
+    int64_t v = 0;
+    while (i < s.size() && s[i] >= '0' && s[i] <= '9') {
+        v = v * 10 + (s[i++] - '0');
+        if (++digits > MAX_DIGITS) return false;
+    }
+    if (i == intStart || (s[intStart] == '0' && i - intStart > 1)) return false;
+    decimals = 0;
+    if (i < s.size() && s[i] == '.') {
+        ++i;
+        while (i < s.size() && s[i] >= '0' && s[i] <= '9') {
+            v = v * 10 + (s[i++] - '0');
+            ++decimals;
+            if (++digits > MAX_DIGITS) return false;
+        }
+        if (decimals == 0) return false;
+    }
+    if (i != s.size() || (neg && v == 0)) return false;
+    value = neg ? -v : v;
+    return true;
+}
+
+void formatFixed(std::string& out, int64_t value, int decimals) {
+    if (value < 0) out += '-';
+    std::string digits = std::to_string(value < 0 ? -value : value);
+    if (digits.size() <= size_t(decimals))
+        digits.insert(0, size_t(decimals) + 1 - digits.size(), '0');
+    if (decimals > 0) digits.insert(digits.size() - size_t(decimals), 1, '.');
+    out += digits;
+}
+
+int64_t parseDelta(std::string_view s) {
+    size_t i = s.size() > 0 && s[0] == '-' ? 1 : 0;
+    if (i == s.size() || s.size() - i > size_t(MAX_DIGITS) + 1) corrupt();
+    int64_t v = 0;
+    for (size_t k = i; k < s.size(); ++k) {
+        if (s[k] < '0' || s[k] > '9') corrupt();
+        v = v * 10 + (s[k] - '0');
+    }
+    return i ? -v : v;
+}
+
+struct Row {
+    std::vector<std::string_view> fields;
+};
+
+std::vector<Row> splitRows(std::string_view text, char delim) {
+    std::vector<Row> rows;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string_view::npos) end = text.size();
+        Row row;
+        size_t f = start;
+        for (size_t i = start; i <= end; ++i) {
+            if (i == end || text[i] == delim) {
+                row.fields.push_back(text.substr(f, i - f));
+                f = i + 1;
+            }
+        }
+        rows.push_back(std::move(row));
+        start = end + 1;
+    }
+    return rows;
+}
+
+// The delimiter most lines agree on, or 0 when the block is not a table.
+char detectDelimiter(std::string_view text) {
+    static const char candidates[] = { ',', '\t', ';', '|', ' ' };
+    size_t lines = size_t(std::count(text.begin(), text.end(), '\n'));
+    if (lines < MIN_ROWS) return 0;
+    char best = 0;
+    size_t bestRows = 0;
+    for (char d : candidates) {
+        std::unordered_map<size_t, size_t> perCount;
+        size_t count = 0;
+        for (char c : text) {
+            if (c == d) ++count;
+            else if (c == '\n') { ++perCount[count]; count = 0; }
+        }
+        for (const auto& [fields, rows] : perCount) {
+            if (fields > 0 && fields < MAX_COLUMNS && rows * 10 >= lines * 9 && rows > bestRows) {
+                best = d;
+                bestRows = rows;
+            }
+        }
+    }
+    return best;
+}
+
+// Header: delimiter, flags, row count, column count, then per column
+// 0 for text or 1 + decimals for a delta-coded numeric column. The body
+// holds the columns in turn; each field ends with the delimiter when its
+// row has more fields and with '\n' when it was the row's last.
+std::string columnsEncode(std::string_view text, char delim) {
+    std::vector<Row> rows = splitRows(text, delim);
+    size_t columns = 0;
+    for (const Row& r : rows) columns = std::max(columns, r.fields.size());
+    if (columns > MAX_COLUMNS || rows.size() > UINT32_MAX) return std::string();
+
+    std::vector<uint8_t> mode(columns, 0);
+    for (size_t c = 0; c < columns; ++c) {
+        int decimals = -1;
+        size_t numeric = 0;
+        bool ok = true;
+        for (const Row& r : rows) {
+            if (c >= r.fields.size()) continue;
+            int d;
+            int64_t v;
+            if (!parseFixed(r.fields[c], d, v) || (decimals >= 0 && d != decimals)) { ok = false; break; }
+            decimals = d;
+            ++numeric;
+        }
+        if (ok && numeric >= MIN_ROWS) mode[c] = uint8_t(1 + decimals);
+    }
+
+    std::string out;
+    out.reserve(text.size() + columns + 8);
+    out += delim;
+    out += char(!text.empty() && text.back() != '\n' ? NO_FINAL_NEWLINE : 0);
+    putU32(out, uint32_t(rows.size()));
+    out += char(columns);
+    for (uint8_t m : mode) out += char(m);
+    for (size_t c = 0; c < columns; ++c) {
+        int64_t prev = 0;
+        for (const Row& r : rows) {
+            if (c >= r.fields.size()) continue;
+            if (mode[c]) {
+                int d;
+                int64_t v;
+                parseFixed(r.fields[c], d, v);
+                out += std::to_string(v - prev);
+                prev = v;
+            }
+            else {
+                out += r.fields[c];
+            }
+            out += c + 1 < r.fields.size() ? delim : '\n';
+        }
+    }
+    return out;
+}
+
+std::string columnsDecode(const std::string& data) {
+    Cursor in(data);
+    char delim = char(in.byte());
+    uint8_t flags = in.byte();
+    uint32_t rowCount = in.u32();
+    size_t columns = in.byte();
+    std::vector<uint8_t> mode(columns);
+    for (auto& m : mode) {
+        m = in.byte();
+        if (m > MAX_DIGITS + 1) corrupt();
+    }
+    if (rowCount > data.size() || delim == '\n') corrupt();
+
+    std::vector<std::vector<std::string>> rows(rowCount);
+    std::vector<uint32_t> open(rowCount);
+    for (uint32_t i = 0; i < rowCount; ++i) open[i] = i;
+    for (size_t c = 0; !open.empty(); ++c) {
+        if (c >= columns) corrupt();
+        std::vector<uint32_t> next;
+        int64_t prev = 0;
+        for (uint32_t i : open) {
+            char stop;
+            std::string_view f = in.until(delim, '\n', stop);
+            if (mode[c]) {
+                int64_t delta = parseDelta(f);
+                if (delta > 2 * MAX_VALUE || delta < -2 * MAX_VALUE) corrupt();
+                prev += delta;
+                if (prev >= MAX_VALUE || prev <= -MAX_VALUE) corrupt();
+                std::string s;
+                formatFixed(s, prev, mode[c] - 1);
+                rows[i].push_back(std::move(s));
+            }
+            else {
+                rows[i].emplace_back(f);
+            }
+            if (stop == delim) next.push_back(i);
+        }
+        open.swap(next);
+    }
+    if (!in.atEnd()) corrupt();
+
+    std::string out;
+    out.reserve(data.size() * 2);
+    for (const auto& row : rows) {
+        for (size_t c = 0; c < row.size(); ++c) {
+            if (c) out += delim;
+            out += row[c];
+        }
+        out += '\n';
+    }
+    if ((flags & NO_FINAL_NEWLINE) && !out.empty()) out.pop_back();
+    return out;
+}
+
+bool isWordChar(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+constexpr size_t MIN_WORD = 4;
+constexpr size_t MAX_WORD = 64;
+
+// Header: entry count, then code byte, length and spelling per entry.
+// Every maximal run of word characters equal to an entry is replaced by
+// its code; codes are bytes absent from the block, so decoding only has
+// to expand them.
+std::string wordsEncode(std::string_view text) {
+    bool used[256] = {};
+    for (unsigned char c : text) used[c] = true;
+    std::vector<uint8_t> codes;
+    for (int c = 255; c >= 0; --c)
+        if (!used[c]) codes.push_back(uint8_t(c));
+    if (codes.empty()) return std::string();
+
+    std::unordered_map<std::string_view, size_t> counts;
+    for (size_t i = 0; i < text.size();) {
+        if (!isWordChar(uint8_t(text[i]))) { ++i; continue; }
+        size_t j = i;
+        while (j < text.size() && isWordChar(uint8_t(text[j]))) ++j;
+        if (j - i >= MIN_WORD && j - i <= MAX_WORD) ++counts[text.substr(i, j - i)];
+        i = j;
+    }
+    std::vector<std::pair<int64_t, std::string_view>> ranked;
+    for (const auto& [w, n] : counts) {
+        int64_t gain = int64_t(w.size() - 1) * int64_t(n) - int64_t(w.size() + 2);
+        if (gain > 0) ranked.push_back({ gain, w });
+    }
+    std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+    if (ranked.size() > codes.size()) ranked.resize(codes.size());
+    int64_t total = 0;
+    for (const auto& r : ranked) total += r.first;
+    if (ranked.empty() || total * 32 < int64_t(text.size())) return std::string();
+
+    std::unordered_map<std::string_view, uint8_t> dict;
+    std::string out;
+    out.reserve(text.size());
+    out += char(ranked.size() - 1);
+    for (size_t k = 0; k < ranked.size(); ++k) {
+        dict[ranked[k].second] = codes[k];
+        out += char(codes[k]);
+        out += char(ranked[k].second.size());
+        out += ranked[k].second;
+    }
+    for (size_t i = 0; i < text.size();) {
+        if (!isWordChar(uint8_t(text[i]))) { out += text[i++]; continue; }
+        size_t j = i;
+        while (j < text.size() && isWordChar(uint8_t(text[j]))) ++j;
+        std::string_view w = text.substr(i, j - i);
+        auto it = dict.find(w);
+        if (it != dict.end()) out += char(it->second);
+        else out += w;
+        i = j;
+    }
+    return out;
+}
+
+std::string wordsDecode(const std::string& data) {
+    Cursor in(data);
+    size_t entries = size_t(in.byte()) + 1;
+    std::string_view dict[256];
+    bool isCode[256] = {};
+    for (size_t k = 0; k < entries; ++k) {
+        uint8_t code = in.byte();
+        size_t len = in.byte();
+        if (isCode[code] || len < MIN_WORD || len > MAX_WORD) corrupt();
+        dict[code] = in.bytes(len);
+        isCode[code] = true;
+    }
+    std::string out;
+    out.reserve(data.size() * 2);
+    while (!in.atEnd()) {
+        uint8_t c = in.byte();
+        if (isCode[c]) out += dict[c];
+        else out += char(c);
+    }
+    return out;
+}
+
+}
+
+std::string filterBlock(const uint8_t* data, size_t n, bool words, BlockFilter& filter) {
+    std::string_view text(reinterpret_cast<const char*>(data), n);
+    std::string out;
+    if (char delim = detectDelimiter(text)) {
+        out = columnsEncode(text, delim);
+        if (!out.empty() && out.size() < n) {
+            filter = BlockFilter::Columns;
+            return out;
+        }
+    }
+    // Only worth it when most of the block is repeated tokens; otherwise
+    // the lost context costs more than the shorter block saves.
+    out.clear();
+    if (words)
+        out = wordsEncode(text);
+    if (!out.empty() && out.size() * 3 <= n * 2) {
+        filter = BlockFilter::Words;
+        return out;
+    }
+    filter = BlockFilter::None;
+    return std::string(text);
+}
+
+std::string unfilterBlock(BlockFilter filter, const std::string& data) {
+    switch (filter) {
+    case BlockFilter::None: return data;
+    case BlockFilter::Columns: return columnsDecode(data);
+    case BlockFilter::Words: return wordsDecode(data);
+    }
+    corrupt();
+}
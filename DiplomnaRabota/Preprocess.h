@@ -0,0 +1,34 @@
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Reversible content-aware transforms applied to a block before the BWT.
+// The id is stored in the block header, so values are part of the format.
+enum class BlockFilter : uint8_t {
+    None = 0,
+    // Delimited text stored column by column; integer and fixed-point
+    // columns become deltas from the previous row.
+    Columns = 1,
+    // Frequent words replaced by byte values the block does not use.
+    Words = 2,
+};
+
+// Largest Columns header: delimiter, flags, row count, column count and
+// one mode byte for each of up to 255 columns. Filtered blocks are coded
+// only when they exceed their input by no more than this, so decoders can
+// bound their buffers by the block length.
+constexpr size_t FILTER_HEADER_MAX = 7 + 255;
+
+// Picks a filter for the block and applies it. Falls back to None, and
+// returns the block unchanged, when no filter makes it smaller. Words is
+// only considered when allowed: it helps when the BWT output is modelled
+// directly, but after MTF the lost word context costs more than it saves.
+std::string filterBlock(const uint8_t* data, size_t n, bool words, BlockFilter& filter);
+
+// Inverse of filterBlock; throws std::runtime_error on malformed input.
+std::string unfilterBlock(BlockFilter filter, const std::string& data);
+
+#endif
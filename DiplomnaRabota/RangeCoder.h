@@ -0,0 +1,105 @@
+#ifndef RANGECODER_H
+#define RANGECODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace rangecoder {
+
+// Number of leading bytes low and high already agree on, which is how
+// many bytes are settled and can be shifted out; 4 when they are equal.
+inline unsigned settledBytes(uint32_t low, uint32_t high) {
+    uint32_t diff = low ^ high;
+    if (diff == 0) return 4;
+#if defined(_MSC_VER)
+    unsigned long bit;
+    _BitScanReverse(&bit, diff);
+    return unsigned(31 - bit) >> 3;
+#else
+    return unsigned(__builtin_clz(diff)) >> 3;
+#endif
+}
+
+// Splits [low, high] at the probability of a 0 bit; the 0 interval is
+// [low, bound] and the 1 interval (bound, high].
+inline uint32_t split(uint32_t low, uint32_t high, uint16_t p1) {
+    return low + uint32_t((uint64_t(high - low) * (0xFFFF - p1)) >> 16);
+}
+
+inline void narrow(uint32_t& low, uint32_t& high, uint32_t bound, int bit) {
+    uint32_t mask = 0u - uint32_t(bit);
+    low = (low & ~mask) | ((bound + 1) & mask);
+    high = (bound & ~mask) | (high & mask);
+}
+
+}
+
+// Carryless binary arithmetic coder; p1 is the 16-bit probability that the
+// bit is 1. Once the top bytes of low and high agree they can no longer
+// change, so all of them are shifted out in a single step.
+class RangeCoder {
+    uint32_t low = 0, high = 0xFFFFFFFF;
+    std::vector<uint8_t>& out;
+public:
+    explicit RangeCoder(std::vector<uint8_t>& o) : out(o) {}
+    void encode(int bit, uint16_t p1) {
+        rangecoder::narrow(low, high, rangecoder::split(low, high, p1), bit);
+        if ((low ^ high) >= 0x01000000) return;
+        unsigned k = rangecoder::settledBytes(low, high);
+        for (unsigned i = 0; i < k; ++i)
+            out.push_back(uint8_t(high >> (24 - 8 * i)));
+        low = uint32_t(uint64_t(low) << (8 * k));
+        high = uint32_t((uint64_t(high) << (8 * k)) | ((uint64_t(1) << (8 * k)) - 1));
+    }
+    void finish() {
+        for (int i = 0; i < 4; ++i) {
+            out.push_back(uint8_t(low >> 24));
+            low <<= 8;
+        }
+    }
+};
+
+// Reads past the end of the payload as zero bytes rather than overrunning.
+class RangeDecoder {
+    uint32_t low = 0, high = 0xFFFFFFFF, code = 0;
+    const uint8_t* p;
+    const uint8_t* end;
+
+    uint8_t next() { return p < end ? *p++ : 0; }
+
+    // The next k bytes, big-endian, in the low 8k bits.
+    uint32_t take(unsigned k) {
+        uint32_t v = 0;
+        if (size_t(end - p) >= 4) {
+            v = uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+            v = uint32_t(uint64_t(v) >> (32 - 8 * k));
+            p += k;
+            return v;
+        }
+        for (unsigned i = 0; i < k; ++i) v = (v << 8) | next();
+        return v;
+    }
+public:
+    RangeDecoder(const uint8_t* data, size_t size) : p(data), end(data + size) {
+        code = take(4);
+    }
+    int decode(uint16_t p1) {
+        uint32_t bound = rangecoder::split(low, high, p1);
+        int bit = code > bound;
+        rangecoder::narrow(low, high, bound, bit);
+        if ((low ^ high) < 0x01000000) {
+            unsigned k = rangecoder::settledBytes(low, high);
+            low = uint32_t(uint64_t(low) << (8 * k));
+            high = uint32_t((uint64_t(high) << (8 * k)) | ((uint64_t(1) << (8 * k)) - 1));
+            code = uint32_t(uint64_t(code) << (8 * k)) | take(k);
+        }
+        return bit;
+    }
+};
+
+#endif
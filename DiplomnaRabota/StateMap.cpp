@@ -0,0 +1,51 @@
+#include "StateMap.h"
+
+namespace bithistory {
+
+uint8_t nextTable[256][2];
+
+}
+
+namespace {
+
+int decay(int n) { return n > 2 ? n / 2 + 1 : n; }
+
+// reciprocal[n] = 16K / (2n + 3): the adaptation rate after n hits.
+int reciprocal[1024];
+
+struct TableInit {
+    TableInit() {
+        for (int s = 0; s < 256; ++s) {
+            int n0 = s & 15, n1 = s >> 4;
+            bithistory::nextTable[s][0] = uint8_t((n0 < 15 ? n0 + 1 : 15) | decay(n1) << 4);
+            bithistory::nextTable[s][1] = uint8_t(decay(n0) | (n1 < 15 ? n1 + 1 : 15) << 4);
+        }
+        for (int i = 0; i < 1024; ++i) reciprocal[i] = 16384 / (i + i + 3);
+    }
+};
+
+const TableInit init;
+
+}
+
+StateMap::StateMap(int lim)
+    : t(256), limit(lim) {
+    reset();
+}
+
+void StateMap::reset() {
+    for (int s = 0; s < 256; ++s) {
+        uint64_t n0 = s & 15, n1 = s >> 4;
+        uint32_t p22 = uint32_t(((2 * n1 + 1) << 22) / (2 * (n0 + n1) + 2));
+        t[s] = p22 << 10;
+    }
+}
+
+void StateMap::update(uint8_t state, int bit) {
+    uint32_t& e = t[state];
+    int n = int(e & 1023);
+    int64_t p = e >> 10;
+    if (n < limit) ++e;
+    else e = (e & 0xFFFFFC00) | uint32_t(limit);
+    e += uint32_t(((((int64_t(bit) << 22) - p) >> 3) * reciprocal[n])) & 0xFFFFFC00;
+}
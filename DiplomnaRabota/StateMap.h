@@ -0,0 +1,34 @@
+#ifndef STATEMAP_H
+#define STATEMAP_H
+
+#include <cstdint>
+#include <vector>
+
+// Bit histories are packed into one byte as a pair of 4-bit counts
+// (n0 | n1 << 4). Observing a bit bumps its count and, when the other
+// count is large, roughly halves it so the state tracks recent behaviour.
+namespace bithistory {
+
+extern uint8_t nextTable[256][2];
+
+inline uint8_t next(uint8_t state, int bit) { return nextTable[state][bit]; }
+inline int priority(uint8_t state) { return (state & 15) + (state >> 4); }
+
+}
+
+// Maps a bit-history state to an adaptive probability. Each entry keeps a
+// 22-bit probability and a 10-bit hit count that slows adaptation down.
+class StateMap {
+    std::vector<uint32_t> t;
+    int limit;
+
+public:
+    explicit StateMap(int limit = 127);
+
+    void reset();
+
+    uint16_t p(uint8_t state) const { return uint16_t(t[state] >> 16); }
+    void update(uint8_t state, int bit);
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include "Stats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+std::string number(double v) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.9g", v);
+    return buf;
+}
+
+std::string number(uint64_t v) {
+    return std::to_string(v);
+}
+
+struct StageField {
+    const char* name;
+    CompressorStats::Stage CompressorStats::* field;
+};
+
+const StageField STAGES[] = {
+    { "filter", &CompressorStats::filter },
+    { "bwt", &CompressorStats::bwt },
+    { "mtf", &CompressorStats::mtf },
+    { "rle", &CompressorStats::rle },
+    { "modelling", &CompressorStats::modelling },
+    { "coding", &CompressorStats::coding },
+};
+
+std::string lengthRange(size_t bucket) {
+    if (bucket == 0) return "0";
+    uint32_t lo = uint32_t(1) << (bucket - 1);
+    uint32_t hi = (lo << 1) - 1;
+    return lo == hi ? std::to_string(lo) : std::to_string(lo) + "-" + std::to_string(hi);
+}
+
+}
+
+bool CompressorStats::available() {
+#ifdef ZEROBIT_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::string CompressorStats::toJson() const {
+    std::string out = "{\n  \"collected\": " + std::string(collected ? "true" : "false")
+        + ",\n  \"blocks\": " + number(blocks) + ",\n  \"stages\": {";
+    for (const auto& stage : STAGES) {
+        const Stage& st = this->*stage.field;
+        out += std::string(&stage == STAGES ? "" : ",") + "\n    \"" + stage.name + "\": { \"seconds\": " + number(st.seconds)
+            + ", \"bytesIn\": " + number(st.bytesIn) + ", \"bytesOut\": " + number(st.bytesOut) + " }";
+    }
+    out += "\n  },\n  \"models\": [";
+    for (size_t i = 0; i < models.size(); ++i) {
+        const Model& m = models[i];
+        out += std::string(i ? "," : "") + "\n    { \"name\": \"" + m.name + "\", \"seconds\": " + number(m.seconds)
+            + ", \"bits\": " + number(m.bits) + ", \"lossBits\": " + number(m.lossBits)
+            + ", \"lossPerBit\": " + number(m.bits ? m.lossBits / double(m.bits) : 0.0)
+            + ", \"lookups\": " + number(m.lookups) + ", \"hits\": " + number(m.hits);
+        if (!m.matchLengths.empty()) {
+            out += ", \"matchLengths\": {";
+            for (size_t b = 0; b < m.matchLengths.size(); ++b)
+                out += std::string(b ? ", " : " ") + "\"" + lengthRange(b) + "\": " + number(m.matchLengths[b]);
+            out += " }";
+        }
+        out += " }";
+    }
+    out += "\n  ],\n  \"mixedLossBits\": " + number(mixedLossBits) + ",\n  \"mixerWeights\": [";
+    for (size_t i = 0; i < mixerWeights.size(); ++i) {
+        out += std::string(i ? "," : "") + "\n    [";
+        for (size_t j = 0; j < mixerWeights[i].size(); ++j)
+            out += std::string(j ? ", " : "") + number(mixerWeights[i][j]);
+        out += "]";
+    }
+    out += "\n  ],\n  \"table\": { \"slots\": " + number(tableSlots) + ", \"used\": " + number(tableUsed)
+        + ", \"evictions\": " + number(tableEvictions) + " }\n}\n";
+    return out;
+}
+
+std::string CompressorStats::toPrometheus() const {
+    std::string out;
+    auto metric = [&](const char* name, const char* type, const char* help) {
+        out += std::string("# HELP zerobit_") + name + " " + help + "\n# TYPE zerobit_" + name + " " + type + "\n";
+    };
+    auto sample = [&](const char* name, const std::string& labels, const std::string& value) {
+        out += std::string("zerobit_") + name + (labels.empty() ? "" : "{" + labels + "}") + " " + value + "\n";
+    };
+
+    metric("blocks_total", "counter", "Blocks measured.");
+    sample("blocks_total", "", number(blocks));
+    auto label = [](const StageField& stage) { return std::string("stage=\"") + stage.name + "\""; };
+    metric("stage_seconds_total", "counter", "Time spent per pipeline stage.");
+    for (const auto& stage : STAGES) sample("stage_seconds_total", label(stage), number((this->*stage.field).seconds));
+    metric("stage_in_bytes_total", "counter", "Bytes into each pipeline stage.");
+    for (const auto& stage : STAGES) sample("stage_in_bytes_total", label(stage), number((this->*stage.field).bytesIn));
+    metric("stage_out_bytes_total", "counter", "Bytes out of each pipeline stage.");
+    for (const auto& stage : STAGES) sample("stage_out_bytes_total", label(stage), number((this->*stage.field).bytesOut));
+
+    metric("model_seconds_total", "counter", "Sampled time in each model's predict and update.");
+    for (const auto& m : models) sample("model_seconds_total", "model=\"" + m.name + "\"", number(m.seconds));
+    metric("model_bits_total", "counter", "Bits each model predicted.");
+    for (const auto& m : models) sample("model_bits_total", "model=\"" + m.name + "\"", number(m.bits));
+    metric("model_loss_bits_total", "counter", "Cost of each model's predictions alone, in bits.");
+    for (const auto& m : models) sample("model_loss_bits_total", "model=\"" + m.name + "\"", number(m.lossBits));
+    metric("model_lookups_total", "counter", "Context lookups per model.");
+    for (const auto& m : models) sample("model_lookups_total", "model=\"" + m.name + "\"", number(m.lookups));
+    metric("model_hits_total", "counter", "Context lookups that found earlier history.");
+    for (const auto& m : models) sample("model_hits_total", "model=\"" + m.name + "\"", number(m.hits));
+    metric("match_length_bytes_total", "counter", "Bytes coded per current match length.");
+    for (const auto& m : models)
+        for (size_t b = 0; b < m.matchLengths.size(); ++b)
+            sample("match_length_bytes_total", "model=\"" + m.name + "\",length=\"" + lengthRange(b) + "\"",
+                number(m.matchLengths[b]));
+
+    metric("mixed_loss_bits_total", "counter", "Cost of the mixed predictions, in bits.");
+    sample("mixed_loss_bits_total", "", number(mixedLossBits));
+    if (!mixerWeights.empty()) {
+        metric("mixer_weight", "gauge", "Mean mixer weight per input after the last block.");
+        const auto& last = mixerWeights.back();
+        // Inputs are named after the models unless calls at several levels
+        // were added up.
+        for (size_t i = 0; i < last.size(); ++i) {
+            std::string input = i + 1 == last.size() ? "bias"
+                : last.size() == models.size() + 1 ? models[i].name : std::to_string(i);
+            sample("mixer_weight", "input=\"" + input + "\"", number(last[i]));
+        }
+    }
+    metric("table_slots", "gauge", "Context-table slots.");
+    sample("table_slots", "", number(tableSlots));
+    metric("table_used_slots", "gauge", "Context-table slots holding history after the last block.");
+    sample("table_used_slots", "", number(tableUsed));
+    metric("table_evictions_total", "counter", "Context-table slots evicted.");
+    sample("table_evictions_total", "", number(tableEvictions));
+    return out;
+}
+
+#ifdef ZEROBIT_STATS
+
+namespace stats {
+
+static const std::array<double, 4096> COST = [] {
+    std::array<double, 4096> t;
+    for (size_t i = 0; i < t.size(); ++i) t[i] = -std::log2((double(i) + 0.5) / 4096);
+    return t;
+}();
+
+double cost(uint16_t p16, int bit) {
+    return COST[bit ? p16 >> 4 : (65535 - p16) >> 4];
+}
+
+static double clockOverhead() {
+    static const double overhead = [] {
+        double best = 1;
+        for (int i = 0; i < 1000; ++i) {
+            auto a = std::chrono::steady_clock::now();
+            auto b = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double>(b - a).count());
+        }
+        return best;
+    }();
+    return overhead;
+}
+
+Timer::Timer(bool on)
+    : active(on) {
+    if (active) start = std::chrono::steady_clock::now();
+}
+
+double Timer::seconds() const {
+    if (!active) return 0;
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return std::max(0.0, t - clockOverhead());
+}
+
+void merge(CompressorStats& into, const CompressorStats& from) {
+    auto add = [](CompressorStats::Stage& a, const CompressorStats::Stage& b) {
+        a.seconds += b.seconds;
+        a.bytesIn += b.bytesIn;
+        a.bytesOut += b.bytesOut;
+    };
+    into.collected |= from.collected;
+    into.blocks += from.blocks;
+    for (const auto& stage : STAGES) add(into.*stage.field, from.*stage.field);
+    // Calls at different levels use different model sets; entries are
+    // matched by name.
+    for (const auto& m : from.models) {
+        auto it = std::find_if(into.models.begin(), into.models.end(),
+            [&](const CompressorStats::Model& e) { return e.name == m.name; });
+        if (it == into.models.end()) {
+            into.models.push_back(m);
+            continue;
+        }
+        it->seconds += m.seconds;
+        it->bits += m.bits;
+        it->lossBits += m.lossBits;
+        it->lookups += m.lookups;
+        it->hits += m.hits;
+        if (it->matchLengths.size() < m.matchLengths.size()) it->matchLengths.resize(m.matchLengths.size());
+        for (size_t i = 0; i < m.matchLengths.size(); ++i) it->matchLengths[i] += m.matchLengths[i];
+    }
+    into.mixedLossBits += from.mixedLossBits;
+    into.mixerWeights.insert(into.mixerWeights.end(), from.mixerWeights.begin(), from.mixerWeights.end());
+    into.tableSlots = from.tableSlots;
+    into.tableUsed = from.tableUsed;
+    into.tableEvictions += from.tableEvictions;
+}
+
+}
+
+#endif
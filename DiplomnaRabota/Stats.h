@@ -0,0 +1,175 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "Compressor.h"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// Collection side of CompressorStats. Without ZEROBIT_STATS the stage
+// timers below are empty and the hooks in the models are not compiled, so
+// a normal build pays nothing.
+namespace stats {
+
+#ifdef ZEROBIT_STATS
+
+// Bytes between samples of the model timings.
+constexpr uint64_t SAMPLE_BYTES = 64;
+// Match lengths 0, 1, 2-3, ..., 32768-65535.
+constexpr size_t LENGTH_BUCKETS = 17;
+
+inline size_t lengthBucket(uint32_t n) {
+    size_t b = 0;
+    while (n) { ++b; n >>= 1; }
+    return b;
+}
+
+// Bits spent coding bit when a one was predicted with probability p16.
+double cost(uint16_t p16, int bit);
+
+// Seconds since construction, less the cost of reading the clock; reads
+// nothing and returns 0 when not active.
+class Timer {
+    bool active;
+    std::chrono::steady_clock::time_point start;
+public:
+    explicit Timer(bool on = true);
+    double seconds() const;
+};
+
+// Context lookups of one model and how many found earlier history.
+struct Lookups {
+    uint64_t lookups = 0;
+    uint64_t hits = 0;
+
+    void count(bool hit) { ++lookups; hits += hit; }
+    void collect(CompressorStats::Model& m) {
+        m.lookups += lookups;
+        m.hits += hits;
+        *this = Lookups();
+    }
+};
+
+// Per-model counters of a ModelPipeline, drained after every block.
+template <size_t N>
+struct PipelineProbe {
+    std::array<uint16_t, N> p{};
+    std::array<double, N> loss{};
+    std::array<double, N> seconds{};
+    uint16_t mixed = 32768;
+    double mixedLoss = 0;
+    double pipelineSeconds = 0;
+    uint64_t bits = 0;
+    uint64_t bytes = 0;
+    uint64_t modelSamples = 0;
+    uint64_t pipelineSamples = 0;
+    // Model calls and whole pipeline steps are timed on different bytes,
+    // so neither measurement includes the other's clock reads.
+    bool timeModels = false;
+    bool timePipeline = false;
+
+    void nextByte() {
+        ++bytes;
+        timeModels = bytes % SAMPLE_BYTES == SAMPLE_BYTES / 2;
+        timePipeline = bytes % SAMPLE_BYTES == 0;
+        modelSamples += timeModels;
+        pipelineSamples += timePipeline;
+    }
+};
+
+void merge(CompressorStats& into, const CompressorStats& from);
+
+// Adds the statistics of blocks coded on any thread to the caller's.
+class Sink {
+    CompressorStats* out;
+    std::mutex m;
+public:
+    explicit Sink(CompressorStats* s) : out(s) {}
+    void add(const CompressorStats& block) {
+        std::lock_guard<std::mutex> lock(m);
+        merge(*out, block);
+    }
+};
+
+// Times the stages of one block, one after another, and hands the result
+// with the pipeline's counters to a Sink. The coder loop is split into
+// modelling and coding by sampling, as its steps are too short to time.
+class Stages {
+    Sink* sink;
+    CompressorStats s;
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+    uint64_t coderCalls = 0;
+    uint64_t coderSamples = 0;
+    double coderSeconds = 0;
+public:
+    explicit Stages(Sink* k) : sink(k) {}
+
+    // Ends stage, which ran since the previous call.
+    void done(CompressorStats::Stage CompressorStats::* stage, uint64_t in, uint64_t out) {
+        if (!sink) return;
+        auto now = std::chrono::steady_clock::now();
+        (s.*stage).seconds += std::chrono::duration<double>(now - last).count();
+        (s.*stage).bytesIn += in;
+        (s.*stage).bytesOut += out;
+        last = now;
+    }
+
+    // Runs one call of the range coder.
+    template <typename F>
+    void code(F&& f) {
+        if (!sink || coderCalls++ % (8 * SAMPLE_BYTES) != 0) {
+            f();
+            return;
+        }
+        Timer timer;
+        f();
+        coderSeconds += timer.seconds();
+        ++coderSamples;
+    }
+
+    // Ends the coder loop, taking the pipeline's counters.
+    template <typename Pipeline>
+    void coded(Pipeline& ms, uint64_t symbols, uint64_t in, uint64_t out) {
+        if (!sink) return;
+        last = std::chrono::steady_clock::now();
+        ms.collect(s);
+        if (coderSamples) s.coding.seconds += coderSeconds * double(coderCalls) / double(coderSamples);
+        s.coding.bytesIn += in;
+        s.coding.bytesOut += out;
+        s.modelling.bytesIn += symbols;
+        s.modelling.bytesOut += symbols;
+    }
+
+    void finish() {
+        if (!sink) return;
+        s.blocks = 1;
+        s.collected = true;
+        sink->add(s);
+    }
+};
+
+#else
+
+class Sink {
+public:
+    explicit Sink(CompressorStats*) {}
+};
+
+class Stages {
+public:
+    explicit Stages(Sink*) {}
+    void done(CompressorStats::Stage CompressorStats::*, uint64_t, uint64_t) {}
+    template <typename F>
+    void code(F&& f) { f(); }
+    template <typename Pipeline>
+    void coded(Pipeline&, uint64_t, uint64_t, uint64_t) {}
+    void finish() {}
+};
+
+#endif
+
+}
+
+#endif
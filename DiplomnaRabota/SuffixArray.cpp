@@ -0,0 +1,139 @@
+#include "SuffixArray.h"
+#include <vector>
+#include <algorithm>
+
+namespace {
+
+template <typename Index>
+struct ByteText {
+    const uint8_t* s;
+    Index last;
+    Index operator[](Index i) const { return i == last ? 0 : Index(s[i]) + 1; }
+};
+
+template <typename Index>
+struct IntText {
+    const Index* s;
+    Index operator[](Index i) const { return s[i]; }
+};
+
+template <typename Index, typename Text>
+class SaIs {
+    const Text& text;
+    Index* sa;
+    Index n;
+    Index k;
+    std::vector<bool> stype;
+    std::vector<Index> bkt;
+
+    bool isLms(Index i) const { return i > 0 && stype[i] && !stype[i - 1]; }
+
+    void getBuckets(bool end) {
+        std::fill(bkt.begin(), bkt.end(), 0);
+        for (Index i = 0; i < n; ++i) ++bkt[text[i]];
+        Index sum = 0;
+        for (Index c = 0; c <= k; ++c) {
+            sum += bkt[c];
+            bkt[c] = end ? sum : sum - bkt[c];
+        }
+    }
+
+    void induceL() {
+        getBuckets(false);
+        for (Index i = 0; i < n; ++i) {
+            Index j = sa[i] - 1;
+            if (sa[i] > 0 && !stype[j]) sa[bkt[text[j]]++] = j;
+        }
+    }
+
+    void induceS() {
+        getBuckets(true);
+        for (Index i = n; i-- > 0;) {
+            Index j = sa[i] - 1;
+            if (sa[i] > 0 && stype[j]) sa[--bkt[text[j]]] = j;
+        }
+    }
+
+    bool sameLms(Index a, Index b) const {
+        for (Index d = 0;; ++d) {
+            if (text[a + d] != text[b + d] || stype[a + d] != stype[b + d])
+                return false;
+            if (d > 0 && (isLms(a + d) || isLms(b + d)))
+                return isLms(a + d) && isLms(b + d);
+        }
+    }
+
+public:
+    // text[n - 1] must be the unique smallest symbol; symbols lie in [0, k].
+    SaIs(const Text& t, Index* out, Index len, Index alphabet)
+        : text(t), sa(out), n(len), k(alphabet), stype(len), bkt(size_t(alphabet) + 1) {
+    }
+
+    void run() {
+        if (n == 1) { sa[0] = 0; return; }
+        stype[n - 1] = true;
+        stype[n - 2] = false;
+        for (Index i = n - 2; i-- > 0;)
+            stype[i] = text[i] < text[i + 1] || (text[i] == text[i + 1] && stype[i + 1]);
+
+        getBuckets(true);
+        std::fill(sa, sa + n, Index(-1));
+        for (Index i = 1; i < n; ++i)
+            if (isLms(i)) sa[--bkt[text[i]]] = i;
+        induceL();
+        induceS();
+
+        Index n1 = 0;
+        for (Index i = 0; i < n; ++i)
+            if (isLms(sa[i])) sa[n1++] = sa[i];
+        std::fill(sa + n1, sa + n, Index(-1));
+
+        Index names = 0, prev = -1;
+        for (Index i = 0; i < n1; ++i) {
+            Index pos = sa[i];
+            if (prev < 0 || !sameLms(pos, prev)) { ++names; prev = pos; }
+            sa[n1 + pos / 2] = names - 1;
+        }
+        for (Index i = n - 1, j = n - 1; i >= n1; --i)
+            if (sa[i] >= 0) sa[j--] = sa[i];
+
+        Index* s1 = sa + n - n1;
+        if (names < n1) {
+            IntText<Index> reduced{ s1 };
+            SaIs<Index, IntText<Index>>(reduced, sa, n1, names - 1).run();
+        }
+        else {
+            for (Index i = 0; i < n1; ++i) sa[s1[i]] = i;
+        }
+
+        for (Index i = 1, j = 0; i < n; ++i)
+            if (isLms(i)) s1[j++] = i;
+        for (Index i = 0; i < n1; ++i) sa[i] = s1[sa[i]];
+        std::fill(sa + n1, sa + n, Index(-1));
+
+        getBuckets(true);
+        for (Index i = n1; i-- > 0;) {
+            Index j = sa[i];
+            sa[i] = -1;
+            sa[--bkt[text[j]]] = j;
+        }
+        induceL();
+        induceS();
+    }
+};
+
+}
+
+template <typename Index>
+static void buildWith(const uint8_t* s, Index* sa, Index n) {
+    ByteText<Index> text{ s, n };
+    SaIs<Index, ByteText<Index>>(text, sa, n + 1, 256).run();
+}
+
+void buildSuffixArray(const uint8_t* s, int32_t* sa, int32_t n) {
+    buildWith(s, sa, n);
+}
+
+void buildSuffixArray(const uint8_t* s, int64_t* sa, int64_t n) {
+    buildWith(s, sa, n);
+}
@@ -0,0 +1,14 @@
+#ifndef SUFFIXARRAY_H
+#define SUFFIXARRAY_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Builds the suffix array of s[0..n) followed by a virtual sentinel that
+// sorts before every byte, using SA-IS (linear time, no comparisons).
+// sa must hold n + 1 entries; sa[0] is always n (the empty suffix).
+// The 64-bit form takes blocks of 2 GiB and more.
+void buildSuffixArray(const uint8_t* s, int32_t* sa, int32_t n);
+void buildSuffixArray(const uint8_t* s, int64_t* sa, int64_t n);
+
+#endif
@@ -0,0 +1,74 @@
+#include "ThreadPool.h"
+
+static thread_local int workerIndex = -1;
+
+int ThreadPool::currentWorker() {
+    return workerIndex;
+}
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0) threads = 1;
+    for (unsigned i = 0; i < threads; ++i)
+        queues.push_back(std::make_unique<Queue>());
+    for (unsigned i = 0; i < threads; ++i)
+        workers.emplace_back([this, i] { workerLoop(i); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& t : workers) t.join();
+}
+
+void ThreadPool::push(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        ++pending;
+    }
+    unsigned q = nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+    {
+        std::lock_guard<std::mutex> lock(queues[q]->m);
+        queues[q]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+bool ThreadPool::tryPop(unsigned self, std::function<void()>& task) {
+    {
+        Queue& own = *queues[self];
+        std::lock_guard<std::mutex> lock(own.m);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t k = 1; k < queues.size(); ++k) {
+        Queue& victim = *queues[(self + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.m);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(unsigned self) {
+    workerIndex = int(self);
+    for (;;) {
+        std::function<void()> task;
+        if (tryPop(self, task)) {
+            --pending;
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stopping || pending > 0; });
+        if (stopping && pending == 0) return;
+    }
+}
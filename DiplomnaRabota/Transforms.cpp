@@ -0,0 +1,233 @@
+#include "Transforms.h"
+#include "FileIO.h"
+#include "SuffixArray.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+unsigned bwtStreamsFor(size_t n) {
+    size_t streams = n / BWT_MIN_SEGMENT;
+    return unsigned(std::clamp<size_t>(streams, 1, BWT_MAX_STREAMS));
+}
+
+// Segment k of a block decoded with `streams` primaries starts at k * step.
+// Callers trim streams so that every segment is non-empty, which makes the
+// step recomputed from the primaries' count the same as the encoder's.
+static size_t segmentStep(size_t n, size_t streams) {
+    return (n + streams - 1) / streams;
+}
+
+// n zero-filled entries, in memory or, when they would take more than
+// limit bytes, in a mapped temporary file. The algorithms are unchanged
+// and still access it at random; only the paging moves to disk.
+template <typename T>
+class WorkArray {
+    std::vector<T> ram;
+    std::unique_ptr<TempMapping> disk;
+    T* p;
+public:
+    WorkArray(size_t n, size_t limit) {
+        if (limit && n > limit / sizeof(T)) {
+            disk = std::make_unique<TempMapping>(n * sizeof(T));
+            p = static_cast<T*>(disk->data());
+        }
+        else {
+            ram.resize(n);
+            p = ram.data();
+        }
+    }
+
+    T* data() { return p; }
+    T& operator[](size_t i) { return p[i]; }
+};
+
+template <typename Index>
+static std::vector<uint64_t> bwtWith(const uint8_t* s, size_t n, size_t step, char* last, size_t memoryLimit) {
+    std::vector<uint64_t> primaries((n + step - 1) / step);
+    WorkArray<Index> sa(n + 1, memoryLimit);
+    buildSuffixArray(s, sa.data(), Index(n));
+    size_t o = 0;
+    for (size_t i = 0; i <= n; ++i) {
+        size_t j = size_t(sa[i]);
+        if (j % step == 0 && j < n) primaries[j / step] = i;
+        if (j != 0) last[o++] = char(s[j - 1]);
+    }
+    return primaries;
+}
+
+std::pair<std::string, std::vector<uint64_t>> bwtTransform(const uint8_t* s, size_t len, unsigned streams,
+    size_t memoryLimit) {
+    if (len == 0) return { std::string(), { 0 } };
+    size_t step = segmentStep(len, std::clamp<size_t>(streams, 1, BWT_MAX_STREAMS));
+    std::string last(len, '\0');
+    std::vector<uint64_t> primaries = len < size_t(INT32_MAX)
+        ? bwtWith<int32_t>(s, len, step, &last[0], memoryLimit)
+        : bwtWith<int64_t>(s, len, step, &last[0], memoryLimit);
+    return { std::move(last), std::move(primaries) };
+}
+
+static size_t lowestSetBit(uint32_t m) {
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, m);
+    return i;
+#else
+    return size_t(__builtin_ctz(m));
+#endif
+}
+
+// Position of c in the 256-entry move-to-front table.
+static size_t mtfFind(const uint8_t* table, uint8_t c) {
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i key = _mm_set1_epi8(char(c));
+    for (size_t i = 0; i < 256; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table + i));
+        uint32_t m = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, key)));
+        if (m) return i + lowestSetBit(m);
+    }
+    return 256;
+#else
+    return size_t(std::find(table, table + 256, c) - table);
+#endif
+}
+
+std::vector<uint8_t> mtfEncode(const std::string& bwt) {
+    alignas(16) uint8_t symbols[256];
+    std::iota(symbols, symbols + 256, 0);
+    std::vector<uint8_t> out(bwt.size());
+    size_t o = 0;
+    for (unsigned char c : bwt) {
+        size_t idx = symbols[0] == c ? 0 : mtfFind(symbols, c);
+        out[o++] = uint8_t(idx);
+        std::memmove(symbols + 1, symbols, idx);
+        symbols[0] = c;
+    }
+    return out;
+}
+
+std::vector<uint8_t> rleZero(const std::vector<uint8_t>& mtf) {
+    std::vector<uint8_t> out;
+    out.reserve(mtf.size());
+    for (size_t i = 0; i < mtf.size();) {
+        if (mtf[i] == 0) {
+            size_t run = 1;
+            while (i + run < mtf.size() && mtf[i + run] == 0 && run < 255) ++run;
+            out.push_back(0);
+            out.push_back(static_cast<uint8_t>(run));
+            i += run;
+        }
+        else {
+            out.push_back(mtf[i++]);
+        }
+    }
+    return out;
+}
+
+std::vector<uint8_t> rleZeroDecode(const std::vector<uint8_t>& rle) {
+    std::vector<uint8_t> out;
+    out.reserve(rle.size() * 2);
+    for (size_t i = 0; i < rle.size();) {
+        if (rle[i] == 0 && i + 1 < rle.size()) {
+            size_t run = rle[i + 1];
+            out.insert(out.end(), run, 0);
+            i += 2;
+        }
+        else {
+            out.push_back(rle[i++]);
+        }
+    }
+    return out;
+}
+
+std::string mtfDecode(const std::vector<uint8_t>& mtf) {
+    alignas(16) uint8_t symbols[256];
+    std::iota(symbols, symbols + 256, 0);
+    std::string out(mtf.size(), '\0');
+    size_t o = 0;
+    for (uint8_t idx : mtf) {
+        uint8_t c = symbols[idx];
+        out[o++] = static_cast<char>(c);
+        std::memmove(symbols + 1, symbols, idx);
+        symbols[0] = c;
+    }
+    return out;
+}
+
+static inline void prefetch(const void* p) {
+#if defined(__GNUC__)
+    __builtin_prefetch(p);
+#elif defined(_M_X64)
+    _mm_prefetch(static_cast<const char*>(p), _MM_HINT_T0);
+#endif
+}
+
+// Each entry packs the row reached next (upper bits) with the byte it
+// outputs (low 8 bits), so one load per byte drives the walk. The streams
+// start at their own primaries and advance in lockstep, keeping several
+// independent cache misses in flight instead of one.
+template <typename Entry>
+static std::string bwtInverseWith(const std::string& last, const std::vector<uint64_t>& primaries,
+    size_t memoryLimit) {
+    size_t n = last.size();
+    uint64_t primary = primaries[0];
+    WorkArray<Entry> next(n + 1, memoryLimit);
+    size_t pos[256];
+    size_t count[256] = {};
+    for (unsigned char c : last) ++count[c];
+    pos[0] = 1;
+    for (int c = 1; c < 256; ++c)
+        pos[c] = pos[c - 1] + count[c - 1];
+    for (size_t i = 0; i < n; ++i) {
+        unsigned char c = last[i];
+        Entry row = Entry(i < primary ? i : i + 1);
+        next[pos[c]++] = Entry((row << 8) | c);
+    }
+
+    const size_t streams = primaries.size();
+    const size_t step = segmentStep(n, streams);
+    const size_t tail = n - (streams - 1) * step;
+    Entry idx[BWT_MAX_STREAMS];
+    for (size_t k = 0; k < streams; ++k) idx[k] = Entry(primaries[k]);
+
+    std::string out(n, '\0');
+    char* dst = &out[0];
+    for (size_t j = 0; j < tail; ++j) {
+        for (size_t k = 0; k < streams; ++k) {
+            Entry e = next[idx[k]];
+            dst[k * step + j] = char(e & 0xFF);
+            idx[k] = e >> 8;
+            prefetch(&next[idx[k]]);
+        }
+    }
+    for (size_t j = tail; j < step; ++j) {
+        for (size_t k = 0; k + 1 < streams; ++k) {
+            Entry e = next[idx[k]];
+            dst[k * step + j] = char(e & 0xFF);
+            idx[k] = e >> 8;
+            prefetch(&next[idx[k]]);
+        }
+    }
+    return out;
+}
+
+std::string bwtInverse(const std::string& last, const std::vector<uint64_t>& primaries, size_t memoryLimit) {
+    size_t n = last.size();
+    if (n == 0) return std::string();
+    if (primaries.empty() || primaries.size() > BWT_MAX_STREAMS
+        || (n + primaries.size() - 1) / primaries.size() * (primaries.size() - 1) >= n)
+        throw std::runtime_error("Corrupt block");
+    for (uint64_t p : primaries)
+        if (p > n) throw std::runtime_error("Corrupt block");
+    if (n < (size_t(1) << 24))
+        return bwtInverseWith<uint32_t>(last, primaries, memoryLimit);
+    return bwtInverseWith<uint64_t>(last, primaries, memoryLimit);
+}
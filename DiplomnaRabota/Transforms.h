@@ -0,0 +1,36 @@
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Block transforms applied before entropy coding, and their inverses.
+
+// Blocks are split into up to BWT_MAX_STREAMS segments of at least
+// BWT_MIN_SEGMENT bytes, each decoded from its own primary index.
+constexpr unsigned BWT_MAX_STREAMS = 16;
+constexpr size_t BWT_MIN_SEGMENT = 64 * 1024;
+
+unsigned bwtStreamsFor(size_t n);
+
+// Returns the BWT of s (sentinel row omitted) and the rows of the suffixes
+// starting each segment; the first is the row of the whole block. At most
+// `streams` primaries are returned, fewer when segments would be empty.
+// The suffix array, and the inverse's row table, are mapped from a
+// temporary file when larger than memoryLimit bytes and left to the
+// kernel's paging; 0 keeps them in memory.
+std::pair<std::string, std::vector<uint64_t>> bwtTransform(const uint8_t* s, size_t n, unsigned streams = 1,
+    size_t memoryLimit = 0);
+std::string bwtInverse(const std::string& last, const std::vector<uint64_t>& primaries, size_t memoryLimit = 0);
+
+std::vector<uint8_t> mtfEncode(const std::string& bwt);
+std::string mtfDecode(const std::vector<uint8_t>& mtf);
+
+// Zero runs become a 0 followed by the run length (1..255).
+std::vector<uint8_t> rleZero(const std::vector<uint8_t>& mtf);
+std::vector<uint8_t> rleZeroDecode(const std::vector<uint8_t>& rle);
+
+#endif
@@ -0,0 +1,484 @@
+#include "Compressor.h"
+#include "FileIO.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+enum ExitCode { EXIT_OK = 0, EXIT_FAILED = 1, EXIT_USAGE = 2 };
+enum class Mode { Auto, Compress, Decompress, Verify, Pack, List, Train };
+
+const char* const EXTENSION = ".srr";
+
+struct CliOptions {
+    Mode mode = Mode::Auto;
+    CompressorOptions codec;
+    std::string output;
+    bool recursive = false;
+    bool force = false;
+    bool quiet = false;
+    // --range: decompress only these bytes of the original.
+    bool range = false;
+    uint64_t rangeOffset = 0;
+    size_t rangeLength = 0;
+    // --archive: pack every input into this one multi-file archive.
+    std::string archive;
+    // --file: decompress only this file of a multi-file archive.
+    std::string file;
+    // --train: write a dictionary built from the inputs here.
+    std::string train;
+    size_t dictSize = Compressor::DEFAULT_DICTIONARY_SIZE;
+    // --stats: write CompressorStats for the whole run here.
+    std::string stats;
+    std::vector<std::string> inputs;
+};
+
+void usage(std::FILE* to) {
+    std::fprintf(to,
+        "Usage: zerobit [options] [file|dir|-]...\n"
+        "Compresses files to .srr archives and back. With no inputs or '-',\n"
+        "reads stdin and writes stdout.\n"
+        "\n"
+        "  -c, --compress         compress (default unless the input ends in .srr)\n"
+        "  -d, --decompress       decompress\n"
+        "      --verify           check archives' checksums without writing output\n"
+        "  -a, --archive FILE     pack all inputs, directories included, into one\n"
+        "                         solid archive; -d on it unpacks into a directory\n"
+        "  -l, --list             list the files in multi-file archives\n"
+        "      --file NAME        decompress only NAME from a multi-file archive\n"
+        "      --train DICT       build a dictionary from sample inputs into DICT\n"
+        "      --dict-size SIZE   largest dictionary --train writes (default 16K)\n"
+        "  -D, --dictionary DICT  prime the models with DICT; archives made with\n"
+        "                         it need it to decompress\n"
+        "  -o, --output PATH      output file, or directory for several inputs;\n"
+        "                         '-' writes a single input's output to stdout\n"
+        "  -r, --recursive        descend into directories\n"
+        "  -1 .. -9, --level N    1 fastest, 9 smallest (default 6)\n"
+        "  -t, --threads N        worker threads, 0 = all cores (default 1)\n"
+        "  -b, --block-size SIZE  input bytes per block (default 100K)\n"
+        "  -m, --memory SIZE      context model memory per block (default set by level)\n"
+        "      --bwt-memory SIZE  keep BWT arrays larger than SIZE in a temporary\n"
+        "                         file, for blocks bigger than RAM (default no limit)\n"
+        "      --no-mtf           code BWT output directly, skipping MTF/RLE\n"
+        "      --no-preprocess    skip the column and word transforms\n"
+        "      --no-fast-blocks   model every block, even compressed or random data\n"
+        "      --seekable         code blocks independently for fast --range\n"
+        "      --range OFF:LEN    decompress only LEN bytes from offset OFF\n"
+        "      --stats FILE       write per-stage and per-model statistics as JSON,\n"
+        "                         or Prometheus text if FILE ends in .prom ('-' is\n"
+        "                         stderr); needs a build with ZEROBIT_STATS\n"
+        "  -f, --force            overwrite existing outputs\n"
+        "  -q, --quiet            no per-file report\n"
+        "  -h, --help             show this help\n"
+        "\n"
+        "SIZE accepts K, M and G suffixes. Exit status: 0 success, 1 a file\n"
+        "failed, 2 usage error.\n");
+}
+
+size_t parseSize(const std::string& text) {
+    if (text.find('-') != std::string::npos) throw std::invalid_argument("negative size " + text);
+    size_t used = 0;
+    unsigned long long v = std::stoull(text, &used);
+    std::string suffix = text.substr(used);
+    int shift = 0;
+    if (suffix == "K" || suffix == "k") shift = 10;
+    else if (suffix == "M" || suffix == "m") shift = 20;
+    else if (suffix == "G" || suffix == "g") shift = 30;
+    else if (!suffix.empty()) throw std::invalid_argument(text);
+    if (v > (std::numeric_limits<size_t>::max() >> shift)) throw std::invalid_argument("size too large " + text);
+    return size_t(v << shift);
+}
+
+void parseRange(const std::string& text, CliOptions& cli) {
+    size_t colon = text.find(':');
+    if (colon == std::string::npos) throw std::invalid_argument("--range needs OFFSET:LENGTH");
+    cli.range = true;
+    cli.rangeOffset = parseSize(text.substr(0, colon));
+    cli.rangeLength = parseSize(text.substr(colon + 1));
+}
+
+std::string readDictionary(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (!in.good() && !in.eof()) throw std::invalid_argument("cannot read dictionary " + path);
+    if (bytes.empty()) throw std::invalid_argument("empty or missing dictionary " + path);
+    return bytes;
+}
+
+unsigned parseThreads(const std::string& text) {
+    unsigned long n = std::stoul(text);
+    if (text.find('-') != std::string::npos || n > Compressor::MAX_THREADS)
+        throw std::invalid_argument("--threads must be between 0 and " + std::to_string(Compressor::MAX_THREADS));
+    return unsigned(n);
+}
+
+void parseArgs(int argc, char* argv[], CliOptions& cli) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::invalid_argument(arg + " needs a value");
+            return argv[++i];
+        };
+        if (arg == "-c" || arg == "--compress") cli.mode = Mode::Compress;
+        else if (arg == "-d" || arg == "--decompress") cli.mode = Mode::Decompress;
+        else if (arg == "--verify") cli.mode = Mode::Verify;
+        else if (arg == "-a" || arg == "--archive") { cli.mode = Mode::Pack; cli.archive = value(); }
+        else if (arg == "-l" || arg == "--list") cli.mode = Mode::List;
+        else if (arg == "--file") cli.file = value();
+        else if (arg == "--train") { cli.mode = Mode::Train; cli.train = value(); }
+        else if (arg == "--dict-size") cli.dictSize = parseSize(value());
+        else if (arg == "-D" || arg == "--dictionary") cli.codec.dictionary = readDictionary(value());
+        else if (arg == "-o" || arg == "--output") cli.output = value();
+        else if (arg == "-r" || arg == "--recursive") cli.recursive = true;
+        else if (arg.size() == 2 && arg[0] == '-' && arg[1] >= '1' && arg[1] <= '9') cli.codec.level = arg[1] - '0';
+        else if (arg == "--level") cli.codec.level = std::stoi(value());
+        else if (arg == "-t" || arg == "--threads") cli.codec.threads = parseThreads(value());
+        else if (arg == "-b" || arg == "--block-size") cli.codec.blockSize = parseSize(value());
+        else if (arg == "-m" || arg == "--memory") cli.codec.modelMemory = parseSize(value());
+        else if (arg == "--bwt-memory") cli.codec.bwtMemory = parseSize(value());
+        else if (arg == "--no-mtf") cli.codec.mtf = false;
+        else if (arg == "--no-preprocess") cli.codec.preprocess = false;
+        else if (arg == "--no-fast-blocks") cli.codec.fastBlocks = false;
+        else if (arg == "--seekable") cli.codec.seekable = true;
+        else if (arg == "--range") parseRange(value(), cli);
+        else if (arg == "--stats") cli.stats = value();
+        else if (arg == "-f" || arg == "--force") cli.force = cli.codec.overwrite = true;
+        else if (arg == "-q" || arg == "--quiet") cli.quiet = true;
+        else if (arg == "-h" || arg == "--help") { usage(stdout); std::exit(EXIT_OK); }
+        else if (arg.size() > 1 && arg[0] == '-') throw std::invalid_argument("unknown option " + arg);
+        else cli.inputs.push_back(arg);
+    }
+    if (cli.codec.level < Compressor::MIN_LEVEL || cli.codec.level > Compressor::MAX_LEVEL)
+        throw std::invalid_argument("level must be between 1 and 9");
+    if (cli.inputs.empty()) cli.inputs.push_back("-");
+    if (!cli.stats.empty() && !CompressorStats::available())
+        throw std::invalid_argument("--stats needs a build with ZEROBIT_STATS=ON");
+    if (cli.range) {
+        if (cli.mode == Mode::Compress || cli.mode == Mode::Verify || cli.inputs.size() != 1 || cli.inputs[0] == "-")
+            throw std::invalid_argument("--range needs a single archive file");
+        cli.mode = Mode::Decompress;
+    }
+    if (!cli.file.empty()) {
+        if (cli.range || (cli.mode != Mode::Auto && cli.mode != Mode::Decompress)
+            || cli.inputs.size() != 1 || cli.inputs[0] == "-")
+            throw std::invalid_argument("--file needs a single archive file");
+        cli.mode = Mode::Decompress;
+    }
+    if ((cli.mode == Mode::Pack || cli.mode == Mode::List || cli.mode == Mode::Train) && cli.inputs[0] == "-")
+        throw std::invalid_argument("multi-file archives need file inputs");
+    if (cli.output == "-" && (cli.inputs.size() != 1 || cli.recursive || cli.mode == Mode::Pack
+        || cli.mode == Mode::List || cli.mode == Mode::Train || cli.mode == Mode::Verify))
+        throw std::invalid_argument("-o - needs a single input to compress or decompress");
+}
+
+bool isArchive(const fs::path& p) { return p.extension() == EXTENSION; }
+
+Mode resolveMode(const CliOptions& cli, const fs::path& input) {
+    if (cli.mode != Mode::Auto) return cli.mode;
+    return isArchive(input) ? Mode::Decompress : Mode::Compress;
+}
+
+fs::path outputName(const fs::path& input, Mode mode) {
+    if (mode == Mode::Compress) return input.filename().string() + EXTENSION;
+    if (isArchive(input)) return input.stem();
+    return input.filename().string() + ".out";
+}
+
+void binaryStdio() {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+}
+
+// Writes bytes to path, replacing it only once they are all written, or
+// to stdout for "-".
+void writeFile(const fs::path& path, const std::string& bytes) {
+    if (path == "-") {
+        binaryStdio();
+        if (!std::cout.write(bytes.data(), std::streamsize(bytes.size())).flush())
+            throw std::runtime_error("Write failed");
+        return;
+    }
+    FileSink out(path.string());
+    out.write(bytes.data(), bytes.size());
+    out.close();
+}
+
+double secondsSince(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Ratio and throughput are always relative to the uncompressed side.
+void report(const CliOptions& cli, const fs::path& from, const fs::path& to, Mode mode, double seconds) {
+    if (cli.quiet) return;
+    uint64_t inBytes = fs::file_size(from), outBytes = fs::file_size(to);
+    uint64_t plain = mode == Mode::Compress ? inBytes : outBytes;
+    uint64_t packed = mode == Mode::Compress ? outBytes : inBytes;
+    double ratio = plain ? 100.0 * double(packed) / double(plain) : 0.0;
+    double rate = seconds > 0 ? double(plain) / seconds / 1e6 : 0.0;
+    std::fprintf(stderr, "%s -> %s: %llu -> %llu bytes (%.1f%%) in %.3f s, %.1f MB/s\n",
+        from.string().c_str(), to.string().c_str(), (unsigned long long)inBytes,
+        (unsigned long long)outBytes, ratio, seconds, rate);
+}
+
+void processStdio(const CliOptions& cli) {
+    binaryStdio();
+    auto t0 = std::chrono::steady_clock::now();
+    if (cli.mode == Mode::Verify) {
+        uint64_t bytes = Compressor::verify(std::cin, cli.codec);
+        if (!cli.quiet)
+            std::fprintf(stderr, "stdin: OK, %llu bytes in %.3f s\n", (unsigned long long)bytes, secondsSince(t0));
+        return;
+    }
+    if (cli.mode == Mode::Decompress)
+        Compressor::decompress(std::cin, std::cout, cli.codec);
+    else
+        Compressor::compress(std::cin, std::cout, cli.codec);
+    if (!cli.quiet)
+        std::fprintf(stderr, "stdin -> stdout in %.3f s\n", secondsSince(t0));
+}
+
+void processFile(const CliOptions& cli, const fs::path& input, const fs::path& output) {
+    Mode mode = resolveMode(cli, input);
+    auto t0 = std::chrono::steady_clock::now();
+    if (mode == Mode::Verify) {
+        uint64_t bytes = Compressor::verify(input.string(), cli.codec);
+        if (!cli.quiet)
+            std::fprintf(stderr, "%s: OK, %llu bytes in %.3f s\n", input.string().c_str(),
+                (unsigned long long)bytes, secondsSince(t0));
+        return;
+    }
+    if (mode == Mode::List) {
+        for (const auto& e : Compressor::listFiles(input.string()))
+            std::printf("%12llu  %s\n", (unsigned long long)e.size, e.name.c_str());
+        return;
+    }
+    bool unpack = mode == Mode::Decompress && cli.file.empty() && !cli.range && Compressor::isPacked(input.string());
+    bool toStdout = output == "-";
+    if (toStdout && unpack)
+        throw std::runtime_error("multi-file archives unpack into a directory, not stdout");
+    // Outputs are replaced only once the new one is complete; an existing
+    // directory is unpacked into.
+    if (!toStdout && fs::exists(output) && !cli.force)
+        throw std::runtime_error(output.string() + " already exists");
+    if (output.has_parent_path()) fs::create_directories(output.parent_path());
+    if (unpack) {
+        // A directory this run created is removed again when it fails.
+        bool existed = fs::exists(output);
+        try {
+            Compressor::unpackFiles(input.string(), output.string(), cli.codec);
+        }
+        catch (...) {
+            std::error_code ec;
+            if (!existed) fs::remove_all(output, ec);
+            throw;
+        }
+        if (!cli.quiet) {
+            auto entries = Compressor::listFiles(input.string());
+            std::fprintf(stderr, "%s -> %s: %zu files, %llu bytes in %.3f s\n", input.string().c_str(),
+                output.string().c_str(), entries.size(),
+                (unsigned long long)(entries.empty() ? 0 : entries.back().offset + entries.back().size),
+                secondsSince(t0));
+        }
+        return;
+    }
+    if (!cli.file.empty()) {
+        std::string bytes = Compressor::readFile(input.string(), cli.file, cli.codec);
+        writeFile(output, bytes);
+        if (!cli.quiet)
+            std::fprintf(stderr, "%s -> %s: %zu bytes in %.3f s\n", input.string().c_str(),
+                output.string().c_str(), bytes.size(), secondsSince(t0));
+        return;
+    }
+    if (cli.range) {
+        std::string bytes = Compressor::readRange(input.string(), cli.rangeOffset, cli.rangeLength, cli.codec);
+        writeFile(output, bytes);
+        if (!cli.quiet)
+            std::fprintf(stderr, "%s -> %s: %zu bytes from offset %llu in %.3f s\n",
+                input.string().c_str(), output.string().c_str(), bytes.size(),
+                (unsigned long long)cli.rangeOffset, secondsSince(t0));
+        return;
+    }
+    if (toStdout) {
+        binaryStdio();
+        std::ifstream in(input, std::ios::binary);
+        if (!in) throw std::runtime_error("Input missing");
+        if (mode == Mode::Compress)
+            Compressor::compress(in, std::cout, cli.codec);
+        else
+            Compressor::decompress(in, std::cout, cli.codec);
+        if (!cli.quiet)
+            std::fprintf(stderr, "%s -> stdout in %.3f s\n", input.string().c_str(), secondsSince(t0));
+        return;
+    }
+    if (mode == Mode::Compress)
+        Compressor::compress(input.string(), output.string(), cli.codec);
+    else
+        Compressor::decompress(input.string(), output.string(), cli.codec);
+    report(cli, input, output, mode, secondsSince(t0));
+}
+
+// Output path for input; base is the directory input was found under when
+// walking recursively, so the tree is mirrored below --output.
+fs::path outputFor(const CliOptions& cli, const fs::path& input, const fs::path& base, bool single) {
+    Mode mode = resolveMode(cli, input);
+    if (cli.output == "-") return cli.output;
+    if (!cli.file.empty() && cli.output.empty()) return fs::u8path(cli.file).filename();
+    if (cli.output.empty()) return input.parent_path() / outputName(input, mode);
+    fs::path out = cli.output;
+    if (single && !fs::is_directory(out)) return out;
+    fs::path rel = base.empty() ? fs::path() : fs::relative(input.parent_path(), base);
+    return (out / rel / outputName(input, mode)).lexically_normal();
+}
+
+bool writeStats(const std::string& path, const CompressorStats& stats) {
+    bool prometheus = fs::path(path).extension() == ".prom";
+    std::string text = prometheus ? stats.toPrometheus() : stats.toJson();
+    if (path == "-") {
+        std::fputs(text.c_str(), stderr);
+        return true;
+    }
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (out.write(text.data(), std::streamsize(text.size()))) return true;
+    std::fprintf(stderr, "zerobit: cannot write %s\n", path.c_str());
+    return false;
+}
+
+int run(const CliOptions& cli) {
+    if (cli.inputs.size() == 1 && cli.inputs[0] == "-") {
+        try {
+            processStdio(cli);
+            return EXIT_OK;
+        }
+        catch (const std::exception& e) {
+            std::fprintf(stderr, "zerobit: %s\n", e.what());
+            return EXIT_FAILED;
+        }
+    }
+
+    if (cli.mode == Mode::Train) {
+        try {
+            std::vector<std::string> samples;
+            for (const auto& name : cli.inputs) {
+                if (fs::is_directory(name)) {
+                    for (const auto& entry : fs::recursive_directory_iterator(name))
+                        if (entry.is_regular_file()) samples.push_back(entry.path().string());
+                }
+                else {
+                    samples.push_back(name);
+                }
+            }
+            if (fs::exists(cli.train) && !cli.force)
+                throw std::runtime_error(cli.train + " already exists");
+            std::string dict = Compressor::trainDictionary(samples, cli.dictSize);
+            writeFile(cli.train, dict);
+            if (!cli.quiet)
+                std::fprintf(stderr, "%zu samples -> %s: %zu bytes\n", samples.size(), cli.train.c_str(), dict.size());
+            return EXIT_OK;
+        }
+        catch (const std::exception& e) {
+            std::fprintf(stderr, "zerobit: %s\n", e.what());
+            return EXIT_FAILED;
+        }
+    }
+
+    if (cli.mode == Mode::Pack) {
+        try {
+            fs::path archive = cli.archive;
+            if (fs::exists(archive) && !cli.force)
+                throw std::runtime_error(archive.string() + " already exists");
+            auto t0 = std::chrono::steady_clock::now();
+            Compressor::packFiles(cli.inputs, archive.string(), cli.codec);
+            if (!cli.quiet) {
+                auto entries = Compressor::listFiles(archive.string());
+                uint64_t plain = entries.empty() ? 0 : entries.back().offset + entries.back().size;
+                uint64_t packed = fs::file_size(archive);
+                double seconds = secondsSince(t0);
+                std::fprintf(stderr, "%zu files -> %s: %llu -> %llu bytes (%.1f%%) in %.3f s, %.1f MB/s\n",
+                    entries.size(), archive.string().c_str(), (unsigned long long)plain, (unsigned long long)packed,
+                    plain ? 100.0 * double(packed) / double(plain) : 0.0, seconds,
+                    seconds > 0 ? double(plain) / seconds / 1e6 : 0.0);
+            }
+            return EXIT_OK;
+        }
+        catch (const std::exception& e) {
+            std::fprintf(stderr, "zerobit: %s\n", e.what());
+            return EXIT_FAILED;
+        }
+    }
+
+    struct Job { fs::path input, base; };
+    std::vector<Job> jobs;
+    for (const auto& name : cli.inputs) {
+        fs::path p = name;
+        if (fs::is_directory(p)) {
+            if (!cli.recursive) {
+                std::fprintf(stderr, "zerobit: %s is a directory (use -r)\n", name.c_str());
+                return EXIT_USAGE;
+            }
+            for (const auto& entry : fs::recursive_directory_iterator(p))
+                if (entry.is_regular_file() && (cli.mode != Mode::Verify || isArchive(entry.path())))
+                    jobs.push_back({ entry.path(), p });
+        }
+        else {
+            jobs.push_back({ p, fs::path() });
+        }
+    }
+
+    int status = EXIT_OK;
+    auto t0 = std::chrono::steady_clock::now();
+    bool single = jobs.size() == 1 && jobs[0].base.empty();
+    for (const auto& job : jobs) {
+        try {
+            processFile(cli, job.input, outputFor(cli, job.input, job.base, single));
+        }
+        catch (const std::exception& e) {
+            std::fprintf(stderr, "zerobit: %s: %s\n", job.input.string().c_str(), e.what());
+            status = EXIT_FAILED;
+        }
+    }
+    if (!cli.quiet && jobs.size() > 1)
+        std::fprintf(stderr, "%zu files in %.3f s\n", jobs.size(), secondsSince(t0));
+    return status;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    CliOptions cli;
+    try {
+        parseArgs(argc, argv, cli);
+    }
+    catch (const std::exception& e) {
+        std::fprintf(stderr, "zerobit: %s\n", e.what());
+        usage(stderr);
+        return EXIT_USAGE;
+    }
+    // Files are processed one after another; they share one set of models.
+    CompressorContext context;
+    cli.codec.context = &context;
+    CompressorStats stats;
+    if (!cli.stats.empty()) cli.codec.stats = &stats;
+
+    int status = run(cli);
+    if (!cli.stats.empty() && !writeStats(cli.stats, stats)) status = EXIT_FAILED;
+    return status;
+}